@@ -0,0 +1,517 @@
+// au_harness: the TopSpin AU macros run end to end without a spectrometer,
+// built and run by ./cmpau. The macro sources are compiled unchanged against
+// the stand-in AU environment of au_stub.h and run on fake datasets in a
+// TopSpin tree of their own (a temporary directory, or the one given):
+//
+//   <root>/prog/bin/poissonv3, gap_sampler		(the programs of this directory)
+//   <root>/exp/stan/nmr/lists/vc/nuslist_<expno>	(the lists the macros write)
+//   <root>/data/<macro>_<case>/<expno>/		(ACQUPATH, where the .out file goes)
+//
+// Prompts are answered from the script of each case; prompts past the script
+// keep their defaults. Every case runs AU_RUNS times and prints one JSON line:
+//
+//   {"macro":"PGS3","dataset":"3D 2048x128x128","points":410,"runs":5,
+//    "total_ms":12.1,"generator_ms":10.9,"macro_ms":1.2,"min_total_ms":11.8,
+//    "nuslist":"ok"}
+//
+// generator_ms is the time in system() (poissonv3 or gap_sampler), macro_ms
+// the rest: parameters, prompts, reading the .out file and writing the list.
+// The nuslist of every run must hold the points of the .out file, line for
+// line, and the macro must have stored NUSLIST and the loop counters; no
+// temporary file of the generator or the list may be left behind.
+//
+//   au_harness [-n runs] [-d root] [macro]	(only the cases whose macro starts with macro)
+//
+// The schedule cache is off (POISSONV3_CACHE) unless it is set. A temporary
+// tree is removed after a run without failures.
+
+#define	_XOPEN_SOURCE	700		//  nftw  //
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "au_stub.h"
+
+#define	AU_RUNS		5
+#define	AU_PARS		16		//  parameters stored per run  //
+#define	AU_ANSWERS	16
+#define	AU_PATHS	4		//  ACQUPATH buffers in use at once  //
+
+char	text[AU_TEXT];
+char	name[AU_TEXT];
+int	expno;
+
+typedef	struct {
+	const	char	*macro;
+	int	( *run )( void );
+	int	parmode;
+	int	td[4];			//  TD of the direct dimension, then of the FETCHPARN axes 1..parmode  //
+	float	swh[4];
+	const	char	*answers[AU_ANSWERS];	//  to the prompts in order, NULL ends  //
+} au_case;
+
+typedef	struct {
+	char	name[32];
+	char	value[PATH_MAX];
+} au_par;
+
+//  the state of the run in progress  //
+
+static	const	au_case	*au_cur;
+static	char	au_root[PATH_MAX];
+static	char	au_data[PATH_MAX];
+static	int	au_answer;
+static	au_par	au_pars[AU_PARS];
+static	int	au_npars;
+static	char	au_out[PATH_MAX];	//  where system() sent the schedule  //
+static	double	au_gen;
+static	char	au_msg[AU_TEXT];
+
+static	double	au_now( void )
+{
+	struct	timeval	tv;
+
+	gettimeofday( &tv, NULL );
+
+	return( tv.tv_sec + 1e-6*tv.tv_usec );
+}
+
+//  the macros, each the body of a function as in TopSpin  //
+
+static	int	au_PGS3( void )
+{
+#include "PGS3"
+}
+
+static	int	au_PGS4( void )
+{
+#include "PGS4"
+}
+
+static	int	au_nusPGS_TS3( void )
+{
+#include "nusPGS_TS3"
+}
+
+static	int	au_nusPGS_TS4( void )
+{
+#include "nusPGS_TS4"
+}
+
+static	int	au_TPGS( void )
+{
+#include "TPGS"
+}
+
+//  2D at 50%, 3D at 10% and 4D at 1%, as the macros suggest; TS answers: seed, sine
+//  portion, decay (and per dimension constant time, linewidth, coupling), points,
+//  tolerance in %, shuffle  //
+
+static	const	au_case	cases[] = {
+	{ "PGS3",	au_PGS3,	1, { 2048, 256 },		{ 12000, 2400 },		{ "64" } },
+	{ "PGS3",	au_PGS3,	2, { 2048, 128, 128 },		{ 12000, 2400, 1600 },		{ "410" } },
+	{ "PGS4",	au_PGS4,	3, { 2048, 64, 64, 96 },	{ 12000, 2400, 1600, 8000 },	{ "492" } },
+	{ "nusPGS_TS3",	au_nusPGS_TS3,	2, { 2048, 128, 128 },		{ 12000, 2400, 1600 },		{ "5", "2", "0", "410", "1", "0" } },
+	{ "nusPGS_TS3",	au_nusPGS_TS3,	2, { 2048, 128, 128 },		{ 12000, 2400, 1600 },		{ "7", "2", "1", "n", "20", "35", "y", "410", "1", "1" } },
+	{ "nusPGS_TS4",	au_nusPGS_TS4,	3, { 2048, 64, 64, 96 },	{ 12000, 2400, 1600, 8000 },	{ "5", "2", "0", "492", "1", "1" } },
+	{ "TPGS",	au_TPGS,	2, { 2048, 128, 128 },		{ 12000, 2400, 1600 },		{ "0", "410" } },
+	{ "TPGS",	au_TPGS,	2, { 2048, 128, 128 },		{ 12000, 2400, 1600 },		{ "1", "410" } },
+	{ NULL }
+};
+
+//  the AU environment  //
+
+void	au_fetchpar( int axis, const char *name, void *p, int type )
+{
+	double	v;
+
+	if ( strcmp( name, "PARMODE" ) == 0 ) v = au_cur->parmode;
+	else if ( strcmp( name, "TD" ) == 0 && axis <= au_cur->parmode ) v = au_cur->td[axis];
+	else if ( strcmp( name, "SWH" ) == 0 && axis <= au_cur->parmode ) v = au_cur->swh[axis];
+	else {
+		fprintf( stderr, "%s: no parameter %s of axis %d in the fake dataset\n", au_cur->macro, name, axis );
+		return;
+	}
+
+	switch ( type ) {
+		case 'i' : *(int*) p = (int) v; break;
+		case 'f' : *(float*) p = (float) v; break;
+		case 'd' : *(double*) p = v; break;
+		default  : sprintf( (char*) p, "%g", v ); break;
+	}
+}
+
+void	au_storepar_s( const char *name, const char *value )
+{
+	int	i;
+
+	for ( i = 0 ; i < au_npars && strcmp( au_pars[i].name, name ) ; i++ );
+	if ( i == AU_PARS ) return;
+	if ( i == au_npars ) au_npars++;
+	snprintf( au_pars[i].name, sizeof( au_pars[i].name ), "%s", name );
+	snprintf( au_pars[i].value, sizeof( au_pars[i].value ), "%s", value );
+}
+
+void	au_storepar_i( const char *name, int value )
+{
+	char	s[32];
+
+	snprintf( s, sizeof( s ), "%d", value );
+	au_storepar_s( name, s );
+}
+
+static	const	char	*au_stored( const char *name )
+{
+	int	i;
+
+	for ( i = 0 ; i < au_npars ; i++ ) if ( strcmp( au_pars[i].name, name ) == 0 ) return( au_pars[i].value );
+
+	return( NULL );
+}
+
+static	const	char	*au_ask( void )
+{
+	if ( au_answer < AU_ANSWERS && au_cur->answers[au_answer] ) return( au_cur->answers[au_answer++] );
+
+	return( NULL );		//  Enter: the default stays  //
+}
+
+void	au_getint( const char *prompt, int *p )
+{
+	const	char	*a = au_ask();
+
+	if ( a ) *p = atoi( a );
+}
+
+void	au_getfloat( const char *prompt, float *p )
+{
+	const	char	*a = au_ask();
+
+	if ( a ) *p = atof( a );
+}
+
+void	au_getdouble( const char *prompt, double *p )
+{
+	const	char	*a = au_ask();
+
+	if ( a ) *p = atof( a );
+}
+
+void	au_getstring( const char *prompt, char *p )
+{
+	const	char	*a = au_ask();
+
+	if ( a ) strcpy( p, a );
+}
+
+void	au_message( const char *kind, const char *message )
+{
+	snprintf( au_msg, sizeof( au_msg ), "%s: %s", kind, message );
+}
+
+char	*au_acqupath( const char *file )
+{
+	static	char	buf[AU_PATHS][PATH_MAX];
+	static	int	next;
+	char	*p = buf[next++ % AU_PATHS];
+
+	snprintf( p, PATH_MAX, "%s/%s", au_data, file );
+
+	return( p );
+}
+
+char	*PathXWinNMRProg( void )
+{
+	static	char	buf[PATH_MAX];
+
+	snprintf( buf, sizeof( buf ), "%s/prog", au_root );
+
+	return( buf );
+}
+
+char	*PathXWinNMRExp( void )
+{
+	static	char	buf[PATH_MAX];
+
+	snprintf( buf, sizeof( buf ), "%s/exp", au_root );
+
+	return( buf );
+}
+
+char	*getstan( char *buf, const char *unused )
+{
+	static	char	stan[PATH_MAX];
+
+	snprintf( stan, sizeof( stan ), "%s/exp/stan/nmr", au_root );
+	if ( buf ) strcpy( buf, stan );
+
+	return( stan );
+}
+
+int	au_system( const char *command )
+{
+	const	char	*out = strstr( command, " --out " );
+	double	t0 = au_now();
+	int	status;
+
+	au_out[0] = 0;
+	if ( out ) sscanf( out+7, " %s", au_out );
+	else if ( ( out = strchr( command, '>' ) ) ) sscanf( out+1, " %s", au_out );
+
+	status = (system)( command );
+	au_gen += au_now()-t0;
+
+	return( status );
+}
+
+//  the fake TopSpin tree  //
+
+static	int	au_mkdirs( const char *path )
+{
+	char	p[PATH_MAX];
+	char	*s;
+
+	snprintf( p, sizeof( p ), "%s", path );
+	for ( s = p+1 ; *s ; s++ ) {
+		if ( *s != '/' ) continue;
+		*s = 0;
+		if ( mkdir( p, 0755 ) && access( p, F_OK ) ) return( -1 );
+		*s = '/';
+	}
+	if ( mkdir( p, 0755 ) && access( p, F_OK ) ) return( -1 );
+
+	return( 0 );
+}
+
+static	int	au_tree( const char *cwd )
+{
+	const	char	*progs[] = { "poissonv3", "gap_sampler", NULL };
+	char	p[PATH_MAX], q[PATH_MAX];
+	int	i;
+
+	snprintf( p, sizeof( p ), "%s/prog/bin", au_root );
+	if ( au_mkdirs( p ) ) return( -1 );
+	snprintf( p, sizeof( p ), "%s/exp/stan/nmr/lists/vc", au_root );
+	if ( au_mkdirs( p ) ) return( -1 );
+
+	for ( i = 0 ; progs[i] ; i++ ) {
+		snprintf( p, sizeof( p ), "%s/prog/bin/%s", au_root, progs[i] );
+		snprintf( q, sizeof( q ), "%s/%s", cwd, progs[i] );
+		unlink( p );
+		if ( access( q, X_OK ) ) {
+			fprintf( stderr, "%s is not built\n", q );
+			return( -1 );
+		}
+		if ( symlink( q, p ) ) return( -1 );
+	}
+
+	return( 0 );
+}
+
+static	int	au_unlink( const char *path, const struct stat *st, int flag, struct FTW *ftw )
+{
+	return( remove( path ) );
+}
+
+//  the points of a schedule file, line by line: -1 on a line of the list that differs  //
+
+static	int	au_compare( const char *out, const char *list )
+{
+	FILE	*fo = fopen( out, "r" );
+	FILE	*fl = fopen( list, "r" );
+	char	a[AU_TEXT], b[AU_TEXT];
+	char	*p, *q, *e;
+	long	x, y;
+	int	n = 0;
+
+	if ( !fo || !fl ) {
+		if ( fo ) fclose( fo );
+		if ( fl ) fclose( fl );
+		return( -1 );
+	}
+
+	for (;;) {
+		while ( ( p = fgets( a, sizeof( a ), fo ) ) && strspn( a, " \t\r\n" ) == strlen( a ) );
+		while ( ( q = fgets( b, sizeof( b ), fl ) ) && strspn( b, " \t\r\n" ) == strlen( b ) );
+		if ( !p || !q ) break;
+
+		for (;;) {
+			x = strtol( p, &e, 10 );
+			if ( e == p ) break;
+			p = e;
+			y = strtol( q, &e, 10 );
+			if ( e == q || x != y ) { n = -1; break; }
+			q = e;
+		}
+		if ( n < 0 || strspn( q, " \t\r\n" ) != strlen( q ) ) { n = -1; break; }
+		n++;
+	}
+	if ( p || q ) n = -1;		//  one ended before the other  //
+
+	fclose( fo );
+	fclose( fl );
+
+	return( n );
+}
+
+//  temporary files of the generator (<file>.XXXXXX) or the macro (<list>.<hash>.tmp) left in dir  //
+
+static	int	au_leftovers( const char *dir )
+{
+	DIR	*d = opendir( dir );
+	struct	dirent	*e;
+	int	n = 0;
+
+	if ( !d ) return( 0 );
+	while ( ( e = readdir( d ) ) ) {
+		const	char	*dot = strrchr( e->d_name, '.' );
+		if ( dot && ( ( strlen( dot ) == 7 && ( strstr( e->d_name, ".out." ) || strncmp( e->d_name, "nuslist_", 8 ) == 0 ) ) || strcmp( dot, ".tmp" ) == 0 ) ) {
+			fprintf( stderr, "left behind: %s/%s\n", dir, e->d_name );
+			n++;
+		}
+	}
+	closedir( d );
+
+	return( n );
+}
+
+static	int	au_order( const void *a, const void *b )
+{
+	double	x = *(const double*) a;
+	double	y = *(const double*) b;
+
+	return( x < y ? -1 : x > y );
+}
+
+static	int	au_run( const au_case *c, int k, int runs, const char *cwd )
+{
+	double	total[64], gen[64], rest[64];
+	char	list[PATH_MAX], dataset[64];
+	const	char	*nuslist;
+	double	t0;
+	int	status, points = 0;
+	int	ok = 1;
+	int	r, i;
+
+	au_cur = c;
+	expno = 10+k;
+	snprintf( name, sizeof( name ), "%s_%d", c->macro, k );
+	snprintf( au_data, sizeof( au_data ), "%s/data/%s/%d", au_root, name, expno );
+	if ( au_mkdirs( au_data ) ) return( -1 );
+
+	snprintf( dataset, sizeof( dataset ), "%dD %d", c->parmode+1, c->td[0] );
+	for ( i = 1 ; i <= c->parmode ; i++ ) snprintf( dataset+strlen( dataset ), sizeof( dataset )-strlen( dataset ), "x%d", c->td[i] );
+
+	if ( runs > 64 ) runs = 64;
+	for ( r = 0 ; r < runs ; r++ ) {
+		au_answer = 0;
+		au_npars = 0;
+		au_gen = 0;
+		au_msg[0] = 0;
+
+		//  no list or schedule from the run before may pass for this one  //
+		snprintf( list, sizeof( list ), "%s/exp/stan/nmr/lists/vc/nuslist_%d", au_root, expno );
+		unlink( list );
+		snprintf( list, sizeof( list ), "%s/exp/stan/nmr/lists/vc/nuslist_%s_%d", au_root, name, expno );
+		unlink( list );
+		unlink( au_acqupath( "nusPGS_setup.out" ) );
+		unlink( au_acqupath( "nusTPGS_setup.out" ) );
+
+		t0 = au_now();
+		status = c->run();
+		total[r] = au_now()-t0;
+		gen[r] = au_gen;
+		rest[r] = total[r]-gen[r];
+
+		if ( chdir( cwd ) ) return( -1 );	//  the macros chdir to the dataset  //
+
+		nuslist = au_stored( "NUSLIST" );
+		if ( status || !nuslist || !au_stored( "L 3" ) || ( c->parmode >= 2 && !au_stored( "L 13" ) ) || ( c->parmode >= 3 && !au_stored( "L 23" ) ) ) {
+			fprintf( stderr, "%s (%s): %s\n", c->macro, dataset, au_msg[0] ? au_msg : "parameters not stored" );
+			ok = 0;
+			break;
+		}
+		snprintf( list, sizeof( list ), "%s/exp/stan/nmr/lists/vc/%s", au_root, nuslist );
+		points = au_compare( au_out, list );
+		if ( points <= 0 ) {
+			fprintf( stderr, "%s (%s): %s does not hold the points of %s\n", c->macro, dataset, list, au_out );
+			ok = 0;
+			break;
+		}
+		snprintf( list, sizeof( list ), "%s/exp/stan/nmr/lists/vc", au_root );
+		if ( au_leftovers( list ) || au_leftovers( au_data ) ) {
+			ok = 0;
+			break;
+		}
+	}
+
+	if ( r == 0 ) return( -1 );
+
+	qsort( total, r, sizeof( double ), au_order );
+	qsort( gen, r, sizeof( double ), au_order );
+	qsort( rest, r, sizeof( double ), au_order );
+
+	printf( "{\"macro\":\"%s\",\"dataset\":\"%s\",\"points\":%d,\"runs\":%d,\"total_ms\":%.3f,\"generator_ms\":%.3f,\"macro_ms\":%.3f,\"min_total_ms\":%.3f,\"nuslist\":\"%s\"}\n",
+		c->macro, dataset, points, r, 1e3*total[r/2], 1e3*gen[r/2], 1e3*rest[r/2], 1e3*total[0], ok ? "ok" : "mismatch" );
+	fflush( stdout );
+
+	return( ok ? 0 : -1 );
+}
+
+int	main( int argc, char** argv )
+{
+	char	cwd[PATH_MAX];
+	const	char	*only = NULL;
+	int	runs = AU_RUNS;
+	int	temporary = 0;
+	int	fail = 0;
+	int	c, i;
+
+	while ( ( c = getopt( argc, argv, "n:d:" ) ) != -1 ) {
+		switch ( c ) {
+			case 'n' : runs = atoi( optarg ); break;
+			case 'd' : snprintf( au_root, sizeof( au_root ), "%s", optarg ); break;
+			default  : fprintf( stderr, "usage: au_harness [-n runs] [-d root] [macro]\n" ); exit( -1 );
+		}
+	}
+	if ( optind < argc ) only = argv[optind];
+	if ( runs < 1 ) runs = 1;
+
+	if ( !getcwd( cwd, sizeof( cwd ) ) ) exit( -1 );
+
+	if ( !au_root[0] ) {
+		snprintf( au_root, sizeof( au_root ), "/tmp/au_harness.XXXXXX" );
+		if ( !mkdtemp( au_root ) ) {
+			perror( "mkdtemp" );
+			exit( -1 );
+		}
+		temporary = 1;
+	}
+	else if ( au_root[0] != '/' ) {
+		char	rel[PATH_MAX];
+		snprintf( rel, sizeof( rel ), "%s", au_root );
+		snprintf( au_root, sizeof( au_root ), "%s/%s", cwd, rel );
+	}
+
+	if ( au_tree( cwd ) ) {
+		fprintf( stderr, "Cannot set up the TopSpin tree in %s\n", au_root );
+		exit( -1 );
+	}
+
+	setenv( "POISSONV3_CACHE", "/dev/null/au_harness", 0 );		//  generate, do not replay  //
+
+	for ( i = 0 ; cases[i].macro ; i++ ) {
+		if ( only && strncmp( cases[i].macro, only, strlen( only ) ) ) continue;
+		if ( au_run( &cases[i], i, runs, cwd ) ) fail = 1;
+	}
+
+	if ( temporary && !fail ) nftw( au_root, au_unlink, 16, FTW_DEPTH | FTW_PHYS );
+	else fprintf( stderr, "datasets in %s\n", au_root );
+
+	exit( fail ? -1 : 0 );
+}
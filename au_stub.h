@@ -0,0 +1,79 @@
+// Stand-in for the TopSpin AU environment, for au_harness.c //
+//
+// The AU macros (PGS3, PGS4, nusPGS_TS3, nusPGS_TS4, TPGS) compile against
+// these definitions unchanged: parameters come from the fake dataset the
+// harness set up, prompts are answered from its script, STOREPAR keeps the
+// values for the checks and system() is timed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define	AU_TEXT		4096		// size of the text buffer of an AU program //
+
+extern	char	text[AU_TEXT];
+extern	char	name[AU_TEXT];		// name of the dataset //
+extern	int	expno;
+
+// input: axis (0 for FETCHPAR, else the axis of FETCHPARN), name, p (*updated*),
+// type ('i', 'f', 'd' or 's' for the type p points to)
+// return: nothing (p is set from the fake dataset, left alone if it has no such parameter)
+
+void	au_fetchpar( int, const char*, void*, int );
+
+// input: name, value
+// return: nothing (the value is kept for the checks of the harness)
+
+void	au_storepar_i( const char*, int );
+
+void	au_storepar_s( const char*, const char* );
+
+// input: prompt, p (*updated*, left at its default when the script has no more answers)
+// return: nothing
+
+void	au_getint( const char*, int* );
+
+void	au_getfloat( const char*, float* );
+
+void	au_getdouble( const char*, double* );
+
+void	au_getstring( const char*, char* );
+
+// input: kind (STOPMSG or QUITMSG), message
+// return: nothing (the message is kept for the report)
+
+void	au_message( const char*, const char* );
+
+// input: file name in the dataset
+// return: its path in the fake dataset (one of a few static buffers)
+
+char	*au_acqupath( const char* );
+
+char	*PathXWinNMRProg( void );
+
+char	*PathXWinNMRExp( void );
+
+char	*getstan( char*, const char* );
+
+// input: command; return: exit status of system(), the time it took added to the run
+
+int	au_system( const char* );
+
+#define	AU_TYPE( p )	_Generic( (p), int*: 'i', float*: 'f', double*: 'd', default: 's' )
+
+#define	GETCURDATA
+#define	FETCHPAR( n, p )	au_fetchpar( 0, n, p, AU_TYPE( p ) );
+#define	FETCHPARN( a, n, p )	au_fetchpar( a, n, p, AU_TYPE( p ) );
+#define	STOREPAR( n, v )	_Generic( (v), char*: au_storepar_s, const char*: au_storepar_s, default: au_storepar_i )( n, v );
+#define	GETINT( t, v )		au_getint( t, &(v) )
+#define	GETFLOAT( t, v )	au_getfloat( t, &(v) )
+#define	GETDOUBLE( t, v )	au_getdouble( t, &(v) )
+#define	GETSTRING( t, v )	au_getstring( t, v )
+#define	STOPMSG( t )		{ au_message( "STOPMSG", t ); return( -1 ); }
+#define	QUITMSG( t )		{ au_message( "QUITMSG", t ); return( 0 ); }
+#define	ACQUPATH( f )		au_acqupath( f )
+#define	system( c )		au_system( c )
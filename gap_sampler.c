@@ -0,0 +1,336 @@
+// gap_sampler: the generator of poissonv3 behind the long option command line
+// the TPGS macro uses:
+//
+//   gap_sampler --ndim N --seed S --nsamples P --X x --Y y --Z z
+//               --randomorder 0|1 --normal 0|1 --ts T [--tol t] [--out file]
+//
+// --ndim, --seed, --nsamples, --tol, the sizes and --randomorder mean what
+// arguments 1, 2, 4, 5, 6-8 and 9 mean to poissonv3 (--tol defaults to 0,
+// i.e. 1e-6). The sine portion is 2.
+//
+// --normal 1 normalizes the gap density before the weight search: the search
+// starts from the weight whose expected number of points is --nsamples
+// (poisson_weight) instead of the fixed poissonv3 default. With --normal 0
+// --ts 0 a seeded schedule, shuffled or not, is the one poissonv3 makes with
+// the same seed and tolerance under the same environment.
+//
+// --ts (tranche sampling) splits the grid along its largest dimension into
+// T slabs (--ts 1 picks 8, --ts T > 1 asks for T) that are sampled
+// independently, each on its own thread. Every slab keeps the sine
+// weighting of its position in the full grid and is asked for its share of
+// the points expected there, so the slabs add up to one schedule.
+//
+// --out writes the schedule to file instead of stdout, through a temporary
+// file renamed over it once complete, as poissonv3 --out does.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "poisson_SAR.h"
+#include "poisson_cache.h"
+
+#define	TS_DEFAULT	8		//  slabs for --ts 1  //
+#define	TS_MAX		64
+
+typedef	struct {
+	int	ndim;
+	int3	z;			//  size of the slab  //
+	int	axis;			//  dimension the grid is split along  //
+	int	lo;			//  first coordinate of the slab along axis  //
+	int	den;			//  sine denominator of the whole grid  //
+	int	tn;			//  points wanted in the slab  //
+	long	seed;
+	float	tol;
+	float	w;
+	int	n;			//  points found  //
+	int	*pts;
+	poisson_ctx	ctx;		//  its stream goes on to shuffle a single tranche  //
+} tranche;
+
+static	int	gap_ndim;
+
+static	int	gap_order( const void *a, const void *b )
+{
+	const	int	*p = (const int*) a;
+	const	int	*q = (const int*) b;
+	int	i;
+
+	for ( i = gap_ndim-1 ; i >= 0 ; i-- ) if ( p[i] != q[i] ) return( p[i] < q[i] ? -1 : 1 );
+
+	return( 0 );
+}
+
+static	void	*gap_tranche( void *arg )
+{
+	tranche	*t = (tranche*) arg;
+	int	i;
+
+	poisson_seed( &t->ctx, t->seed );
+
+	t->ctx.s_off = t->lo;
+	t->ctx.s_den = t->den;
+	if ( t->den == 0 ) t->ctx.threads = poisson_threads();	//  the whole grid, as poissonv3 draws it  //
+
+	t->n = poisson_points( &t->ctx, t->ndim, t->z, t->tn, t->tol, 2.0, &t->w, &t->pts );
+
+	for ( i = 0 ; i < t->n ; i++ ) t->pts[i*t->ndim+t->axis] += t->lo;	//  back to grid coordinates  //
+
+	return( NULL );
+}
+
+//  split tn between the slabs in proportion to the points expected in each  //
+
+static	int	gap_split( tranche *t, int nt, int ndim, int3 z, int axis, int tn, float ld, float w )
+{
+	double	*m;
+	double	e[TS_MAX];
+	double	et = 0;
+	int	s_max = 0;
+	long long	cap[TS_MAX];
+	int	left = tn;
+	int	i, j, k, s, x;
+
+	//  histogram of coordinate sums over the other dimensions  //
+
+	for ( i = 0 ; i < ndim ; i++ ) if ( i != axis ) s_max += z[i]-1;
+	m = (double*) calloc( s_max+1, sizeof( double ) );
+	m[0] = 1;
+	for ( i = 0, s_max = 0 ; i < ndim ; i++ ) {
+		if ( i == axis ) continue;
+		for ( s = s_max+z[i]-1 ; s >= 0 ; s-- ) {
+			double	c = 0;
+			for ( j = 0 ; j < z[i] && j <= s ; j++ ) if ( s-j <= s_max ) c += m[s-j];
+			m[s] = c;
+		}
+		s_max += z[i]-1;
+	}
+
+	for ( k = 0 ; k < nt ; k++ ) {
+		e[k] = 0;
+		for ( x = t[k].lo ; x < t[k].lo+t[k].z[axis] ; x++ ) {
+			for ( s = 0 ; s <= s_max ; s++ ) e[k] += m[s]/( 1.0 + poisson_lambda( x+s, z, ld, w, 2.0 ) );
+		}
+		et += e[k];
+		for ( cap[k] = 1, i = 0 ; i < ndim ; i++ ) cap[k] *= t[k].z[i];
+	}
+
+	free( m );
+
+	if ( et <= 0 ) return( -1 );
+
+	for ( k = 0 ; k < nt ; k++ ) {
+		t[k].tn = (int) ( tn*e[k]/et );
+		if ( t[k].tn > cap[k] ) t[k].tn = cap[k];
+		left -= t[k].tn;
+	}
+
+	//  the rounding remainder goes, one point at a time, to the slabs furthest below their share  //
+
+	while ( left > 0 ) {
+		double	best = -1e300;
+		for ( j = -1, k = 0 ; k < nt ; k++ ) {
+			double	d = tn*e[k]/et - t[k].tn;
+			if ( t[k].tn < cap[k] && d > best ) { best = d; j = k; }
+		}
+		if ( j < 0 ) return( -1 );
+		t[j].tn++;
+		left--;
+	}
+
+	return( 0 );
+}
+
+static	void	usage( void )
+{
+	fprintf( stderr, "usage: gap_sampler --ndim N --seed S --nsamples P --X x --Y y --Z z\n" );
+	fprintf( stderr, "                   --randomorder 0|1 --normal 0|1 --ts T [--tol t] [--out file]\n" );
+	fprintf( stderr, "       gap_sampler --version\n" );
+	exit( -1 );
+}
+
+int	main( int argc, char** argv )
+{
+	static	struct	option	opts[] = {
+		{ "ndim",	required_argument,	NULL,	'n' },
+		{ "seed",	required_argument,	NULL,	's' },
+		{ "nsamples",	required_argument,	NULL,	'p' },
+		{ "X",		required_argument,	NULL,	'x' },
+		{ "Y",		required_argument,	NULL,	'y' },
+		{ "Z",		required_argument,	NULL,	'z' },
+		{ "randomorder",required_argument,	NULL,	'r' },
+		{ "normal",	required_argument,	NULL,	'N' },
+		{ "ts",		required_argument,	NULL,	't' },
+		{ "tol",	required_argument,	NULL,	'T' },
+		{ "out",	required_argument,	NULL,	'o' },
+		{ "version",	no_argument,		NULL,	'v' },
+		{ NULL,		0,			NULL,	0 }
+	};
+
+	tranche	t[TS_MAX];
+	pthread_t	tid[TS_MAX];
+	int	started[TS_MAX];
+	int3	z = { 0, 0, 0 };
+	int	ndim = 0;
+	float	seed = 0;
+	long	base;
+	float	tol = 0;
+	int	tn = 0;
+	int	randomorder = 0;
+	int	normal = 0;
+	int	ts = 0;
+	int	nt = 1;
+	int	axis = 0;
+	int	den, n, c, i, k;
+	long long	grid;
+	int	*pts;
+	poisson_ctx	ctx;
+	float	ld;
+	float	w;
+	const	char	*out = NULL;
+	char	tmp[PATH_MAX];
+	FILE	*fp = stdout;
+
+	while ( ( c = getopt_long( argc, argv, "", opts, NULL ) ) != -1 ) {
+		switch ( c ) {
+			case 'n' : ndim = atoi( optarg ); break;
+			case 's' : seed = atof( optarg ); break;		//  as poissonv3 reads it  //
+			case 'p' : tn = atoi( optarg ); break;
+			case 'x' : z[0] = atoi( optarg ); break;
+			case 'y' : z[1] = atoi( optarg ); break;
+			case 'z' : z[2] = atoi( optarg ); break;
+			case 'r' : randomorder = atoi( optarg ); break;
+			case 'N' : normal = atoi( optarg ); break;
+			case 't' : ts = atoi( optarg ); break;
+			case 'T' : tol = atof( optarg ); break;
+			case 'o' : out = optarg; break;
+			case 'v' : printf( "gap_sampler %d\n", POISSON_GEN_VERSION ); exit( 0 );
+			default  : usage();
+		}
+	}
+	if ( optind != argc ) usage();
+
+	if ( ndim < 1 || ndim > 3 ) {
+		fprintf( stderr, "Must make 1, 2 or 3 gap dimensions\n" );
+		exit( -1 );
+	}
+
+	//  the same conventions as poissonv3 for the unused dimensions  //
+
+	if ( ndim == 1 ) { z[1] = 1; z[2] = 1; }
+	if ( ndim == 2 ) z[2] = 0;
+
+	for ( grid = 1, i = 0 ; i < ndim ; i++ ) {
+		if ( z[i] < 1 ) {
+			fprintf( stderr, "Size of dimension %d must be positive\n", i+1 );
+			exit( -1 );
+		}
+		grid *= z[i];
+	}
+	if ( tn < 1 || tn > grid ) {
+		fprintf( stderr, "Number of samples must be between 1 and %lld\n", grid < INT_MAX ? grid : (long long) INT_MAX );
+		exit( -1 );
+	}
+
+	base = seed != 0 ? (long) seed : time( NULL );
+	if ( tol == 0 ) tol = 0.000001;
+
+	switch ( ndim ) {
+		case 1 : ld = (float)z[0]/(float)tn; break;
+		case 2 : ld = ( (float)z[0]*z[1] / (float) tn ); break;
+		default: ld = ( (float)z[0]*z[1]*z[2] / (float) tn ); break;
+	}
+	den = z[0]+z[1]+z[2]-3;
+
+	w = ndim == 3 ? 1.0 : 2.0;
+	if ( normal ) poisson_weight( ndim, z, tn, ld, 2.0, &w );
+
+	//  slabs along the largest dimension, at least two planes thick  //
+
+	if ( ts ) {
+		nt = ts == 1 ? TS_DEFAULT : ts;
+		for ( i = 1 ; i < ndim ; i++ ) if ( z[i] > z[axis] ) axis = i;
+		if ( nt > TS_MAX ) nt = TS_MAX;
+		if ( nt > z[axis]/2 ) nt = z[axis]/2;
+		if ( nt < 1 ) nt = 1;
+	}
+
+	for ( k = 0 ; k < nt ; k++ ) {
+		t[k].ndim = ndim;
+		memcpy( t[k].z, z, sizeof( int3 ) );
+		t[k].axis = axis;
+		t[k].lo = (int) ( (long) z[axis]*k/nt );
+		t[k].z[axis] = (int) ( (long) z[axis]*(k+1)/nt ) - t[k].lo;
+		t[k].den = nt > 1 ? den : 0;
+		t[k].tn = tn;
+		t[k].seed = base + 104729L*k;
+		t[k].tol = tol;
+		t[k].w = w;
+		t[k].n = 0;
+		t[k].pts = NULL;
+		poisson_ctx_init( &t[k].ctx );
+	}
+
+	if ( nt > 1 ) {
+		float	wn = w;
+
+		if ( !normal ) poisson_weight( ndim, z, tn, ld, 2.0, &wn );
+		if ( gap_split( t, nt, ndim, z, axis, tn, ld, wn ) ) {
+			fprintf( stderr, "Cannot split %d samples between %d tranches\n", tn, nt );
+			exit( -1 );
+		}
+	}
+
+	for ( k = 0 ; k < nt ; k++ ) {
+		started[k] = 0;
+		if ( t[k].tn == 0 ) continue;
+		if ( nt > 1 && pthread_create( &tid[k], NULL, gap_tranche, &t[k] ) == 0 ) started[k] = 1;
+		else gap_tranche( &t[k] );
+	}
+
+	for ( n = 0, k = 0 ; k < nt ; k++ ) {
+		if ( started[k] ) pthread_join( tid[k], NULL );
+		if ( nt > 1 ) poisson_ctx_free( &t[k].ctx );
+		n += t[k].n;
+	}
+
+	//  one schedule in grid order, the first dimension fastest  //
+
+	pts = (int*) malloc( (size_t) n*ndim*sizeof( int ) );
+	for ( i = 0, k = 0 ; k < nt ; k++ ) {
+		if ( t[k].n ) memcpy( pts+i, t[k].pts, (size_t) t[k].n*ndim*sizeof( int ) );
+		i += t[k].n*ndim;
+		free( t[k].pts );
+	}
+
+	gap_ndim = ndim;
+	if ( nt > 1 ) qsort( pts, n, ndim*sizeof( int ), gap_order );
+
+	if ( out && !( fp = replace_begin( out, tmp ) ) ) {
+		fprintf( stderr, "Cannot write %s\n", out );
+		exit( -1 );
+	}
+
+	//  a single tranche shuffles on from its own stream, as poissonv3 does; slabs share one past theirs  //
+
+	if ( nt == 1 ) ctx = t[0].ctx;
+	else {
+		poisson_ctx_init( &ctx );
+		poisson_seed( &ctx, base + 104729L*TS_MAX );
+	}
+	poisson_emit( &ctx, fp, ndim, pts, n, randomorder == 1, 1 );
+	poisson_ctx_free( &ctx );
+
+	free( pts );
+
+	if ( out && replace_commit( fp, tmp, out, 1 ) ) {
+		fprintf( stderr, "Cannot write %s\n", out );
+		exit( -1 );
+	}
+
+	exit( 0 );
+}
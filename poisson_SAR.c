@@ -5,12 +5,15 @@
 // 1) number of NUS dimensions
 // 2) seed num (0 means seed based on execution time) 
 // 3) sine portion (2, 1 or 0. 1 and 0 are not practical. Only here for completeness and experimental purposes)
-// 4) number of sampled points
+//    or another density shape: exp:a, qsine:o, gauss:s or decay:r1,r2,r3 (see poisson_SAR.h)
+// 4) number of sampled points, or rising numbers n1,n2,... for nested schedules,
+//    optionally followed by @file to extend the schedule in file
 // 5) tolerance (1 = 100%)
 // 6) total size of dimension 1 (the full range)
 // 7) total size of dimension 2 (the full range) 
 // 8) total size of dimension 3 (the full range) 
-// 9) 0 = in order 1 = shuffled
+// 9) 0 = in order 1 = shuffled, followed by :pc to acquire only some quadrature
+//    components at each point (2D and 3D, see poisson_SAR.h)
 //
 // This version constructs outputs in slow -> slower -> slowest order 
 // from left to right. Direct dimension is fast and linear so not 
@@ -26,45 +29,111 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
-#include <sys/time.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 #include "poisson_SAR.h"
+#include "poisson_cache.h"
+#include "poisson_serve.h"
+#include "poisson_simd.h"
 
 
-void shuffle(int *array, size_t n)
+//  drand48 compatible generator: x = a*x + c mod 2^48, returned as x/2^48.  //
+//  Kept per context so that concurrent schedules do not share a stream.    //
+
+double	poisson_rand( poisson_ctx *ctx )
 {
+	ctx->x = ( ctx->x*0x5DEECE66DULL + 0xBULL ) & 0xFFFFFFFFFFFFULL;
 
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    int usec = tv.tv_usec;
-    srand48(usec);
-
-
-    if (n > 1)
-    {
-        size_t i;
-        for (i = n - 1; i > 0; i--)
-        {
-          size_t j = (unsigned int) (drand48()*(i+1));
-	  if ( j != 0 ) { // don't shuffle the first point
-          	int t = array[j];
-          	array[j] = array[i];
-          	array[i] = t;
-		}
-        }
-    }
+	return( (double) ctx->x * ( 1.0/281474976710656.0 ) );
+}
+
+void	poisson_seed( poisson_ctx *ctx, long seed )
+{
+	ctx->x = ( (unsigned long long) ( seed & 0xFFFFFFFFL ) << 16 ) | 0x330EULL;	//  as srand48  //
+}
+
+void	poisson_seed_clock( poisson_ctx *ctx, float seed )
+{
+	static	long	nonce = 0;	//  keeps concurrent clock seeded schedules apart  //
+
+	if ( seed != 0 ) poisson_seed( ctx, seed );
+	else poisson_seed( ctx, time( NULL ) + __sync_fetch_and_add( &nonce, 1 ) );
+}
+
+void	poisson_ctx_init( poisson_ctx *ctx )
+{
+	memset( ctx, 0, sizeof( poisson_ctx ) );
+}
+
+static	int	**poisson_plane( int **v2d, int n0, int n1 )
+{
+	int	i;
+
+	if ( v2d ) free( v2d[0] );
+	free( v2d );
+
+	v2d = ( int** ) malloc( n0*sizeof(int*) );
+	v2d[0] = ( int* ) malloc ( (size_t) n0*n1*sizeof(int) );
+	for ( i = 1 ; i < n0 ; i++ ) v2d[i] = v2d[0] + (size_t) i*n1;
+
+	return( v2d );
+}
+
+void	poisson_scratch( poisson_ctx *ctx, int ndim, int3 z )
+{
+	int	i;
+	int	z_max = 1;
+
+	for ( i = 0 ; i < 3 ; i++ ) z_max = z[i] > z_max ? z[i] : z_max;
+
+	if ( z_max > ctx->v_max ) {
+		free( ctx->v );
+		ctx->v = ( int* ) malloc( z_max*sizeof( int ) );
+		ctx->v_max = z_max;
+	}
+
+	if ( ndim < 3 ) return;
+
+	if ( z[0] != ctx->zs[0] || z[1] != ctx->zs[1] || z[2] != ctx->zs[2] ) {
+		ctx->v2d_01 = poisson_plane( ctx->v2d_01, z[0], z[1] );
+		ctx->v2d_12 = poisson_plane( ctx->v2d_12, z[1], z[2] );
+		ctx->v2d_20 = poisson_plane( ctx->v2d_20, z[2], z[0] );
+		free( ctx->sp_plane );
+		ctx->sp_plane = ( int* ) malloc( 4*(z[0]+z[1]+z[2])*sizeof( int ) );
+		free( ctx->plan );
+		ctx->plan = ( int* ) malloc( 4*(z[0]+z[1]+z[2])*sizeof( int ) );
+		for ( i = 0 ; i < 3 ; i++ ) ctx->zs[i] = z[i];
+	}
+}
+
+void	poisson_ctx_free( poisson_ctx *ctx )
+{
+	int	i;
+
+	free( ctx->v );
+	if ( ctx->v2d_01 ) { free( ctx->v2d_01[0] ); free( ctx->v2d_01 ); }
+	if ( ctx->v2d_12 ) { free( ctx->v2d_12[0] ); free( ctx->v2d_12 ); }
+	if ( ctx->v2d_20 ) { free( ctx->v2d_20[0] ); free( ctx->v2d_20 ); }
+	free( ctx->sp );
+	free( ctx->sp_plane );
+	free( ctx->plan );
+	free( ctx->lt );
+	for ( i = 0 ; i < 3 ; i++ ) free( ctx->ax[i] );
+	poisson_ctx_init( ctx );
 }
 
 
 
-int	poisson ( double lmbd )
+static	int	poisson_knuth( poisson_ctx *ctx, double L )
 {
-	double	L = exp( -lmbd );
 	int	k = 0;
 	double	p = 1;
 
 	do {
-		double	u = drand48();
+		double	u = poisson_rand( ctx );
 		p *= u;
 		k += 1;
 	} while ( p >= L );
@@ -72,13 +141,215 @@ int	poisson ( double lmbd )
 	return( k-1 );
 }
 
-int	poisson_gap( int  direction, int3 i_0, int3 i_n, int *v, float ld, float w, float sine_portion )
+int	poisson ( poisson_ctx *ctx, double lmbd )
+{
+	return( poisson_knuth( ctx, exp( -lmbd ) ) );
+}
+
+int	poisson_shape_parse( const char *arg, int *shape, float *a )
 {
+	static	const	char	*names[] = { "exp:", "qsine:", "gauss:", "decay:" };
+	const	char	*c;
+	char	*end;
 	int	i;
+
+	*shape = POISSON_SINE;
+	for ( i = 0 ; i < 3 ; i++ ) a[i] = 0;
+
+	for ( i = 0 ; i < 4 ; i++ ) if ( strncmp( arg, names[i], strlen( names[i] ) ) == 0 ) break;
+	if ( i == 4 ) return( 0 );		//  a sine portion  //
+
+	*shape = i+1;
+	c = arg+strlen( names[i] );
+
+	if ( *shape == POISSON_DECAY ) {	//  1 to 3 rates, the missing ones 0  //
+		for ( i = 0 ; i < 3 ; i++ ) {
+			a[i] = strtod( c, &end );
+			if ( end == c || a[i] < 0 || a[i] > 10 ) return( -1 );
+			if ( *end == 0 ) return( 0 );
+			if ( *end != ',' ) return( -1 );
+			c = end+1;
+		}
+		return( -1 );
+	}
+
+	a[0] = strtod( c, &end );
+	if ( *end || end == c ) return( -1 );
+
+	switch ( *shape ) {
+		case POISSON_EXP   : return( a[0] > 0 && a[0] <= 50 ? 0 : -1 );
+		case POISSON_QSINE : return( a[0] >= 0 && a[0] < 1 ? 0 : -1 );
+		default            : return( a[0] >= 0.05 && a[0] <= 10 ? 0 : -1 );
+	}
+}
+
+int	poisson_order_parse( const char *arg, int *shuffled, int *partial )
+{
+	char	*end;
+	long	o = strtol( arg, &end, 10 );
+
+	*shuffled = ( o == 1 );
+	*partial = 0;
+
+	if ( *end == 0 ) return( 0 );		//  anything atoi took before  //
+	if ( strcmp( end, ":pc" ) || end == arg || ( o != 0 && o != 1 ) ) return( -1 );
+
+	*partial = 1;
+
+	return( 0 );
+}
+
+int	poisson_levels_parse( const char *arg, int *tn, const char **file )
+{
+	const	char	*c = arg;
+	char	*end;
+	long	t;
+	int	n = 0;
+
+	*file = NULL;
+
+	for (;;) {
+		t = strtol( c, &end, 10 );
+		if ( end == c || t < 1 || t > INT_MAX || n == POISSON_LEVELS ) return( -1 );
+		if ( n > 0 && t <= tn[n-1] ) return( -1 );
+		tn[n++] = (int) t;
+		if ( *end != ',' ) break;
+		c = end+1;
+	}
+
+	if ( *end == '@' && end[1] ) *file = end+1;
+	else if ( *end ) return( -1 );
+
+	return( n );
+}
+
+//  exp(-lamda) of a gap only depends on the coordinate sum it starts at: the
+//  table holds it for every sum. Each density shape has its own loop, so the
+//  choice is made once per table and never per gap. The sine loop computes
+//  exactly what poisson_gap used to.  //
+
+#define	POISSON_FILL( f )	for ( s = 0 ; s < n ; s++ ) { double t = (double) s/den; ctx->lt[s] = exp( -( (ld-1.0)*w*( f ) ) ); }
+
+static	double	*poisson_table( poisson_ctx *ctx, int3 i_n, float den, float ld, float w, float sine_portion )
+{
+	int	s, n = ctx->s_off+1;
+	double	a = ctx->shape_a[0];
+	double	e;
+
+	for ( s = 0 ; s < 3 ; s++ ) n += i_n[s] > 1 ? i_n[s]-1 : 0;
+
+	if ( ctx->lt && n <= ctx->lt_n && ctx->lt_key[0] == ld && ctx->lt_key[1] == w && ctx->lt_key[2] == sine_portion
+		&& ctx->lt_key[3] == den && ctx->lt_key[4] == ctx->s_off
+		&& ctx->lt_key[5] == ctx->shape && ctx->lt_key[6] == ctx->shape_a[0] ) return( ctx->lt );
+
+	free( ctx->lt );
+	ctx->lt = ( double* ) malloc( n*sizeof( double ) );
+	ctx->lt_n = n;
+	ctx->lt_key[0] = ld;
+	ctx->lt_key[1] = w;
+	ctx->lt_key[2] = sine_portion;
+	ctx->lt_key[3] = den;
+	ctx->lt_key[4] = ctx->s_off;
+	ctx->lt_key[5] = ctx->shape;
+	ctx->lt_key[6] = ctx->shape_a[0];
+
+	switch ( ctx->shape ) {
+		case POISSON_EXP : {	e = exp( a ) - 1;
+					POISSON_FILL( ( exp( a*t ) - 1 )/e );
+				} ; break;
+		case POISSON_QSINE : {	POISSON_FILL( sin( ( a + (1-a)*t )*M_PI/2 ) );
+				} ; break;
+		case POISSON_GAUSS : {	e = exp( 1/( 2*a*a ) ) - 1;
+					POISSON_FILL( ( exp( t*t/( 2*a*a ) ) - 1 )/e );
+				} ; break;
+		default : {	for ( s = 0 ; s < n ; s++ ) {
+					if (sine_portion == 0) ctx->lt[s] = exp( -( (ld-1.0)*w ) );
+					else ctx->lt[s] = exp( -( (ld-1.0)*w*sin((float)(s)/den*M_PI/sine_portion) ) );
+				}
+			} ; break;
+	}
+
+	return( ctx->lt );
+}
+
+//  --stats: one update per line, nothing at all when the stats are off  //
+
+#define	POISSON_BACK( ctx, n )	if ( (ctx)->stats ) (ctx)->stats->back += (n)
+
+static	void	poisson_gap_stats( poisson_ctx *ctx, int start, int end, int n, int *v, int k )
+{
+	if ( start >= n ) return;
+	ctx->stats->calls += k + ( k == 0 || v[k-1] != n-1 );	//  the last gap ends past the line unless it ended on its last point  //
+	ctx->stats->uniforms += end-start;			//  a gap of g takes g+1 numbers  //
+}
+
+//  Decay matched density: a point whose signal has decayed by exp(-u),
+//  u = r1*x1+r2*x2+r3*x3, is sampled exp(-u) times as densely as the first
+//  point, so its gap has the mean lamda = (1+(ld-1)*w)*exp(u) - 1. exp(u) is
+//  the product of one table entry per dimension; constant time dimensions
+//  have r = 0 and are sampled evenly.  //
+
+#define	POISSON_LAMDA_MAX	700.0	//  exp(-lamda) must stay above 0 for the draw to end  //
+
+static	void	poisson_axes( poisson_ctx *ctx, int3 i_n )
+{
+	int	d, x;
+
+	for ( d = 0 ; d < 3 ; d++ ) {
+		if ( ctx->ax[d] && ctx->ax_n[d] >= i_n[d] && ctx->ax_r[d] == ctx->shape_a[d] ) continue;
+		free( ctx->ax[d] );
+		ctx->ax_n[d] = i_n[d] > 1 ? i_n[d] : 1;
+		ctx->ax_r[d] = ctx->shape_a[d];
+		ctx->ax[d] = ( double* ) malloc( ctx->ax_n[d]*sizeof( double ) );
+		for ( x = 0 ; x < ctx->ax_n[d] ; x++ ) ctx->ax[d][x] = exp( (double) ctx->ax_r[d]*x );
+	}
+}
+
+static	int	poisson_gap_decay( poisson_ctx *ctx, int direction, int3 i_0, int3 i_n, int *v, float ld, float w )
+{
+	int	k = 0;
+	int	active = i_0[direction];
+	int	start = active;
+	double	c = 1.0 + (ld-1.0)*w;
+	double	*e;
+	double	l;
+	int	d;
+
+	poisson_axes( ctx, i_n );
+
+	for ( d = 0 ; d < 3 ; d++ ) if ( d != direction ) c *= ctx->ax[d][i_0[d] > 0 ? i_0[d] : 0];
+	e = ctx->ax[direction];
+
+	while ( active < i_n[direction] ) {
+
+		l = c*e[active] - 1.0;
+		if ( l > POISSON_LAMDA_MAX ) l = POISSON_LAMDA_MAX;
+
+		if ( ctx->lanes ) active += lanes_poisson( ctx->lane, exp( -l ) );
+		else active += poisson_knuth( ctx, exp( -l ) );
+
+		if ( active < i_n[direction] ) v[k++] = active;
+		active += 1;
+	}
+
+	if ( ctx->stats ) poisson_gap_stats( ctx, start, active, i_n[direction], v, k );
+
+	return( k );
+}
+
+int	poisson_gap( poisson_ctx *ctx, int  direction, int3 i_0, int3 i_n, int *v, float ld, float w, float sine_portion )
+{
 	int	k = 0;
 	int	active = 0;
+	int	start;
+	float	den = ctx->s_den ? (float) ctx->s_den : (float)(i_n[0]+i_n[1]+i_n[2]-3);
+	double	*L;
+
+	int3	passive = { 0, 0, 0 };
 
-	int3	passive;
+	if ( ctx->shape == POISSON_DECAY ) return( poisson_gap_decay( ctx, direction, i_0, i_n, v, ld, w ) );
+
+	L = poisson_table( ctx, i_n, den, ld, w, sine_portion );
 
 	switch	(direction ) {
 		case 0:	{	active = i_0[0] ;
@@ -95,12 +366,14 @@ int	poisson_gap( int  direction, int3 i_0, int3 i_n, int *v, float ld, float w,
 			} ; break;
 	}
 
+	L += passive[0]+passive[1]+ctx->s_off;		//  L[active] from here on  //
+	start = active;
+
 	while ( active < i_n[direction] ) {
 
 		//  Now make a gap : //
-		//printf("Active = %i\n", active);
-		if (sine_portion == 0) { active += poisson( (ld-1.0)*w);}
-		else {active += poisson( (ld-1.0)*w*sin((float)(active+passive[0]+passive[1])/(float)(i_n[0]+i_n[1]+i_n[2]-3)*M_PI/sine_portion) );}
+		if ( ctx->lanes ) active += lanes_poisson( ctx->lane, L[active] );
+		else active += poisson_knuth( ctx, L[active] );
 
 		if ( active < i_n[direction] ) {
 
@@ -112,20 +385,21 @@ int	poisson_gap( int  direction, int3 i_0, int3 i_n, int *v, float ld, float w,
 
 	}
 
+	if ( ctx->stats ) poisson_gap_stats( ctx, start, active, i_n[direction], v, k );
+
 	return ( k );
 }
 
-int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
+int	poisson_01_gap( poisson_ctx *ctx, int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
 {
 
 	int	i;
 	int	ii;
 	int	n;
 	int	z_min;
-	int	z_max;
 	int	d_min;
 
-	static	int	*v = NULL;
+	int	*v = ctx->v;
 
 	int3	s;
 	int3	k;
@@ -134,11 +408,6 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 
 //	fprintf( stderr, "poisson_01_gap\n" );
 
-	z_max = z[0] > z[1] ? z[0] : z[1];
-
-	//printf("z0: %i and z1: %i\n", z[0], z[1]);
-	if ( !v ) v = (int*) malloc( z_max*sizeof( int ) );
-
 	for( i = 0 ; i < 3 ; i++ ) s[i] = s_0[i];
 
 	for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
@@ -167,8 +436,9 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[0] < z[0] ) {
 
 					while( origin[0] > 0 && !v2d[origin[0]][origin[1]] ) origin[0] -=1;
+					POISSON_BACK( ctx, s[0]-origin[0] );
 
-					n = poisson_gap( 0, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 0, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[0] ; i < z[0] ; i++ ) v2d[i][origin[1]] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[v[i]][origin[1]] = 1;
@@ -193,8 +463,9 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[1] < z[1] ) {
 
 					while( origin[1] > 0 && !v2d[origin[0]][origin[1]] ) origin[1] -=1;
+					POISSON_BACK( ctx, s[1]-origin[1] );
 
-					n = poisson_gap( 1, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 1, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[1] ; i < z[1] ; i++ ) v2d[origin[0]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[0]][v[i]] = 1;
@@ -219,8 +490,9 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[1] < z[1] ) {
 
 					while( origin[1] > 0 && !v2d[origin[0]][origin[1]] ) origin[1] -=1;
+					POISSON_BACK( ctx, s[1]-origin[1] );
 
-					n = poisson_gap( 1, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 1, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[1] ; i < z[1] ; i++ ) v2d[origin[0]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[0]][v[i]] = 1;
@@ -245,8 +517,9 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[0] < z[0] ) {
 
 					while( origin[0] > 0 && !v2d[origin[0]][origin[1]] ) origin[0] -=1;
+					POISSON_BACK( ctx, s[0]-origin[0] );
 
-					n = poisson_gap( 0, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 0, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[0] ; i < z[0] ; i++ ) v2d[i][origin[1]] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[v[i]][origin[1]] = 1;
@@ -259,26 +532,29 @@ int	poisson_01_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 
 		}
 	}
+	double	t = ctx->stats ? poisson_clock() : 0;
+
 	n = 0;
 
 	for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
 		for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) if (v2d[k[0]][k[1]] == 1) n += 1;
 	}
 
+	if ( ctx->stats ) ctx->stats->t_count += poisson_clock()-t;
+
 	return( n );
 }
 
-int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
+int	poisson_12_gap( poisson_ctx *ctx, int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
 {
 
 	int	i;
 	int	ii;
 	int	n;
 	int	z_min;
-	int	z_max;
 	int	d_min;
 
-	static	int	*v = NULL;
+	int	*v = ctx->v;
 
 	int3	s;
 	int3	k;
@@ -287,10 +563,6 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 
 	//fprintf( stderr, "poisson_12_gap\n" );
 
-	z_max = z[1] > z[2] ? z[1] : z[2];
-
-	if ( !v ) v = (int*) malloc( z_max*sizeof( int ) );
-
 	for( i = 0 ; i < 3 ; i++ ) s[i] = s_0[i];
 
 	for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) {
@@ -328,8 +600,9 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[1] < z[1] ) {
 
 					while( origin[1] > 0 && !v2d[origin[1]][origin[2]] ) origin[1] -=1;
+					POISSON_BACK( ctx, s[1]-origin[1] );
 
-					n = poisson_gap( 1, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 1, origin, z, v, ld, w, sine_portion );
 	
 					for ( i = origin[1] ; i < z[1] ; i++ ) v2d[i][origin[2]] = 0;
 	
@@ -360,8 +633,9 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[2] < z[2] ) {
 
 					while( origin[2] > 0 && !v2d[origin[1]][origin[2]] ) origin[2] -=1;
+					POISSON_BACK( ctx, s[2]-origin[2] );
 
-					n = poisson_gap( 2, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 2, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[2] ; i < z[2] ; i++ ) v2d[origin[1]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[1]][v[i]] = 1;
@@ -391,8 +665,9 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[2] < z[2] ) {
 
 					while( origin[2] > 0 && !v2d[origin[1]][origin[2]] ) origin[2] -=1;
+					POISSON_BACK( ctx, s[2]-origin[2] );
 
-					n = poisson_gap( 2, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 2, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[2] ; i < z[2] ; i++ ) v2d[origin[1]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[1]][v[i]] = 1;
@@ -421,8 +696,9 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[1] < z[1] ) {
 
 					while( origin[1] > 0 && !v2d[origin[1]][origin[2]] ) origin[1] -=1;
+					POISSON_BACK( ctx, s[1]-origin[1] );
 
-					n = poisson_gap( 1, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 1, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[1] ; i < z[1] ; i++ ) v2d[i][origin[2]] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[v[i]][origin[2]] = 1;
@@ -447,7 +723,7 @@ int	poisson_12_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 	return( n );
 }
 
-int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
+int	poisson_20_gap( poisson_ctx *ctx, int3 s_0, int3 z, int **v2d, float ld, float w, float sine_portion )
 {
 
 	int	i;
@@ -455,9 +731,8 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 	int	n;
 	int	z_min;
 	int	d_min;
-	int	z_max;
 
-	static	int	*v;
+	int	*v = ctx->v;
 
 	int3	s;
 	int3	k;
@@ -466,10 +741,6 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 
 	//fprintf( stderr, "poisson_20_gap\n" );
 
-	z_max = z[2] > z[0] ? z[2] : z[0];
-
-	if ( !v ) v = (int*) malloc( z_max*sizeof( int ) );
-
 	for( i = 0 ; i < 3 ; i++ ) s[i] = s_0[i];
 
 	for ( k[2] = 0 ; k[2] < z[2] ; k[2]++ ) {
@@ -499,8 +770,9 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[2] < z[2] ) {
 
 					while( origin[2] > 0 && !v2d[origin[2]][origin[0]] ) origin[2] -=1;
+					POISSON_BACK( ctx, s[2]-origin[2] );
 
-					n = poisson_gap( 2, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 2, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[2] ; i < z[2] ; i++ ) v2d[i][origin[0]] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[v[i]][origin[0]] = 1;
@@ -526,8 +798,9 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[0] < z[0] ) {
 
 					while( origin[0] > 0 && !v2d[origin[2]][origin[0]] ) origin[0] -=1;
+					POISSON_BACK( ctx, s[0]-origin[0] );
 
-					n = poisson_gap( 0, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 0, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[0] ; i < z[0] ; i++ ) v2d[origin[2]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[2]][v[i]] = 1;
@@ -553,8 +826,9 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[0] < z[0] ) {
 
 					while( origin[0] > 0 && !v2d[origin[2]][origin[0]] ) origin[0] -=1;
+					POISSON_BACK( ctx, s[0]-origin[0] );
 
-					n = poisson_gap( 0, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 0, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[0] ; i < z[0] ; i++ ) v2d[origin[2]][i] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[origin[2]][v[i]] = 1;
@@ -580,8 +854,9 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 				if ( origin[2] < z[2] ) {
 
 					while( origin[2] > 0 && !v2d[origin[2]][origin[0]] ) origin[2] -=1;
+					POISSON_BACK( ctx, s[2]-origin[2] );
 
-					n = poisson_gap( 2, origin, z, v, ld, w, sine_portion );
+					n = poisson_gap( ctx, 2, origin, z, v, ld, w, sine_portion );
 
 					for ( i = origin[2] ; i < z[2] ; i++ ) v2d[i][origin[0]] = 0;
 					for ( i = 0 ; i < n ; i++ ) v2d[v[i]][origin[0]] = 1;
@@ -604,46 +879,330 @@ int	poisson_20_gap( int3 s_0, int3 z, int **v2d, float ld, float w, float sine_p
 	return( n );
 }
 
-int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine_portion )
+//  Sparse path of poisson_012_gap.
+//
+//  The volume is only ever written, a whole plane region at a time: the plane
+//  fixing dimension d at origin[d] overwrites every point whose other two
+//  coordinates are not below those of its origin. Each coordinate value is
+//  the origin of exactly one plane of each orientation, so the final value of
+//  a point comes from whichever of its (at most) three covering planes was
+//  written last. Keeping the points of every plane with the order the planes
+//  were written in is therefore enough to rebuild the volume, and takes
+//  memory in proportion to the sampled points rather than to the grid.  //
+
+static	int	poisson_012_plane( int d, int *p, int3 z )
 {
-	int	i;
-	int	ii;
-	int	n;
-	int	z_min;
-	int	d_min;
+	return( d == 0 ? p[0] : d == 1 ? z[0]+p[1] : z[0]+z[1]+p[2] );
+}
 
-	static	int	**v2d_01 = NULL;
-	static	int	**v2d_12 = NULL;
-	static	int	**v2d_20 = NULL;
+//  keep the points no later plane has overwritten, as 4 ints each or, when
+//  the sweep is done (last), as the 3 coordinates of the final points  //
 
-	int3	s;
+static	int	poisson_012_sparse( poisson_ctx *ctx, int3 z, int last )
+{
+	size_t	i;
+	int	*p, *q, *r;
+	int	d, e, f, g;
+	int	n = 0;
+
+	for ( i = 0 ; i < ctx->sp_n ; i++ ) {
+		p = ctx->sp + 4*i;
+		d = p[3];
+		q = ctx->sp_plane + 4*poisson_012_plane( d, p, z );
+		for ( e = 0 ; e < 3 ; e++ ) {
+			if ( e == d ) continue;
+			r = ctx->sp_plane + 4*poisson_012_plane( e, p, z );
+			if ( r[0] < q[0] ) continue;		//  written before (or never)  //
+			for ( g = 1, f = 0 ; f < 3 ; f++ ) if ( f != e && p[f] < r[1+f] ) g = 0;
+			if ( g ) break;				//  overwritten by a later plane  //
+		}
+		if ( e < 3 ) continue;
+		memmove( ctx->sp + ( last ? 3 : 4 )*n, p, ( last ? 3 : 4 )*sizeof( int ) );
+		n++;
+	}
+	ctx->sp_n = n;
+
+	return( n );
+}
+
+static	void	poisson_012_begin( poisson_ctx *ctx, int d, int3 origin, int3 z )
+{
+	int	*q = ctx->sp_plane + 4*poisson_012_plane( d, origin, z );
+
+	q[0] = ctx->sp_seq++;
+	q[1] = origin[0];
+	q[2] = origin[1];
+	q[3] = origin[2];
+}
+
+static	void	poisson_012_keep( poisson_ctx *ctx, int3 z, int3 k, int d )
+{
+	int	*q;
+
+	if ( ctx->sp_n == ctx->sp_max ) {
+		//  drop the points overwritten so far before growing: the store follows the live points  //
+		if ( (size_t) poisson_012_sparse( ctx, z, 0 ) > ctx->sp_max/2 || !ctx->sp_max ) {
+			ctx->sp_max = ctx->sp_max ? 2*ctx->sp_max : 4096;
+			ctx->sp = ( int* ) realloc( ctx->sp, 4*ctx->sp_max*sizeof( int ) );
+		}
+	}
+	q = ctx->sp + 4*ctx->sp_n++;
+	q[0] = k[0];
+	q[1] = k[1];
+	q[2] = k[2];
+	q[3] = d;
+}
+
+static	void	poisson_012_put( poisson_ctx *ctx, int d, int3 origin, int3 z, int **v2d, int ***v3d )
+{
+	int	a = d == 2 ? 0 : d == 0 ? 1 : 2;	//  plane rows  //
+	int	b = d == 2 ? 1 : d == 0 ? 2 : 0;	//  plane columns  //
 	int3	k;
 
-	float3	fss;
+	if ( v3d ) {
+		switch ( d ) {
+			case 2 : for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
+					for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
+						v3d[k[0]][k[1]][origin[2]] = v2d[k[0]][k[1]];
+					}
+				} ; break;
+			case 0 : for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
+					for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
+						v3d[origin[0]][k[1]][k[2]] = v2d[k[1]][k[2]];
+					}
+				} ; break;
+			case 1 : for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
+					for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
+						v3d[k[0]][origin[1]][k[2]] = v2d[k[2]][k[0]];
+					}
+				} ; break;
+		}
+		return;
+	}
+
+	poisson_012_begin( ctx, d, origin, z );
+
+	k[d] = origin[d];
+	for ( k[a] = origin[a] ; k[a] < z[a] ; k[a]++ ) {
+		for ( k[b] = origin[b] ; k[b] < z[b] ; k[b]++ ) if ( v2d[k[a]][k[b]] == 1 ) poisson_012_keep( ctx, z, k, d );
+	}
+}
+
+//  Plane streams (ctx->threads > 0).
+//
+//  The planes never read the volume, only their own origin, so once each has
+//  a random stream of its own they can all be generated at the same time and
+//  composited afterwards in sweep order. The stream of a plane is derived from
+//  one draw of the schedule's stream and the plane's place in the sweep: the
+//  schedule depends on the seed, not on the number of threads.  //
+
+typedef	struct {
+	poisson_ctx	*ctx;			//  schedule being generated  //
+	int	*z;
+	float	ld;
+	float	w;
+	float	sine_portion;
+	unsigned long long	base;		//  draw the plane streams derive from  //
+	int	next;				//  next plane to take  //
+	int	**pts;				//  points of each plane, in plane coordinates  //
+	int	*n;
+} poisson_streams;
+
+static	unsigned long long	poisson_stream( unsigned long long base, int i )
+{
+	unsigned long long	x = base + 0x9E3779B97F4A7C15ULL*(i+1);	//  splitmix64  //
+
+	x = ( x ^ ( x >> 30 ) )*0xBF58476D1CE4E5B9ULL;
+	x = ( x ^ ( x >> 27 ) )*0x94D049BB133111EBULL;
+
+	return( ( x ^ ( x >> 31 ) ) & 0xFFFFFFFFFFFFULL );
+}
+
+static	int	**poisson_012_build( poisson_ctx *ctx, int d, int3 origin, int3 z, float ld, float w, float sine_portion )
+{
+	switch ( d ) {
+		case 2 : poisson_01_gap( ctx, origin, z, ctx->v2d_01, ld, w, sine_portion ); return( ctx->v2d_01 );
+		case 0 : poisson_12_gap( ctx, origin, z, ctx->v2d_12, ld, w, sine_portion ); return( ctx->v2d_12 );
+		default: poisson_20_gap( ctx, origin, z, ctx->v2d_20, ld, w, sine_portion ); return( ctx->v2d_20 );
+	}
+}
+
+static	void	poisson_012_do( poisson_ctx *ctx, int d, int3 origin, int3 z, int ***v3d, float ld, float w, float sine_portion )
+{
+	int	*q;
+
+	if ( ctx->threads > 0 ) {		//  only the sweep order is taken here  //
+		q = ctx->plan + 4*ctx->plan_n++;
+		q[0] = d;
+		q[1] = origin[0];
+		q[2] = origin[1];
+		q[3] = origin[2];
+		return;
+	}
+
+	poisson_012_put( ctx, d, origin, z, poisson_012_build( ctx, d, origin, z, ld, w, sine_portion ), v3d );
+}
+
+static	void	*poisson_012_worker( void *arg )
+{
+	poisson_streams	*st = (poisson_streams*) arg;
+	poisson_ctx	wc;
+	poisson_stats	ws;
+	int	**v2d;
+	int	*q, *c;
+	int	i, d, a, b, m;
+	int3	origin;
+	int3	k;
+
+	poisson_ctx_init( &wc );
+	poisson_scratch( &wc, 3, st->z );
+	wc.s_off = st->ctx->s_off;
+	wc.s_den = st->ctx->s_den;
+	wc.lanes = 1;
+	wc.shape = st->ctx->shape;
+	memcpy( wc.shape_a, st->ctx->shape_a, sizeof( wc.shape_a ) );
+	memset( &ws, 0, sizeof( ws ) );
+	if ( st->ctx->stats ) wc.stats = &ws;
+
+	while ( ( i = __sync_fetch_and_add( &st->next, 1 ) ) < st->ctx->plan_n ) {
+
+		q = st->ctx->plan + 4*i;
+		d = q[0];
+		a = d == 2 ? 0 : d == 0 ? 1 : 2;
+		b = d == 2 ? 1 : d == 0 ? 2 : 0;
+		origin[0] = q[1];
+		origin[1] = q[2];
+		origin[2] = q[3];
+
+		lanes_seed( poisson_stream( st->base, i ), wc.lane );
+		v2d = poisson_012_build( &wc, d, origin, st->z, st->ld, st->w, st->sine_portion );
+
+		for ( m = 0, k[a] = origin[a] ; k[a] < st->z[a] ; k[a]++ ) {
+			for ( k[b] = origin[b] ; k[b] < st->z[b] ; k[b]++ ) m += v2d[k[a]][k[b]] == 1;
+		}
+		c = st->pts[i] = ( int* ) malloc( (m > 0 ? 2*m : 1)*sizeof( int ) );
+		for ( k[a] = origin[a] ; k[a] < st->z[a] ; k[a]++ ) {
+			for ( k[b] = origin[b] ; k[b] < st->z[b] ; k[b]++ ) {
+				if ( v2d[k[a]][k[b]] == 1 ) { *c++ = k[a]; *c++ = k[b]; }
+			}
+		}
+		st->n[i] = m;
+	}
+
+	if ( wc.stats ) {
+		__sync_fetch_and_add( &st->ctx->stats->calls, ws.calls );
+		__sync_fetch_and_add( &st->ctx->stats->uniforms, ws.uniforms );
+		__sync_fetch_and_add( &st->ctx->stats->back, ws.back );
+	}
+
+	poisson_ctx_free( &wc );
 
-	if ( !v2d_01 ) {
-		v2d_01 = ( int** ) malloc( z[0]*sizeof(int*) );
-		for ( i = 0 ; i < z[0] ; i++ ) v2d_01[i] = ( int* ) malloc ( z[1]*sizeof(int) );
+	return( NULL );
+}
+
+//  write a plane given as its points into the volume, as poisson_012_put does  //
+
+static	void	poisson_012_list( poisson_ctx *ctx, int d, int3 origin, int3 z, int *pts, int m, int ***v3d )
+{
+	int	a = d == 2 ? 0 : d == 0 ? 1 : 2;
+	int	b = d == 2 ? 1 : d == 0 ? 2 : 0;
+	int	i;
+	int3	k;
+
+	k[d] = origin[d];
+
+	if ( v3d ) {
+		for ( k[a] = origin[a] ; k[a] < z[a] ; k[a]++ ) {
+			for ( k[b] = origin[b] ; k[b] < z[b] ; k[b]++ ) v3d[k[0]][k[1]][k[2]] = 0;
+		}
+		for ( i = 0 ; i < m ; i++ ) {
+			k[a] = pts[2*i];
+			k[b] = pts[2*i+1];
+			v3d[k[0]][k[1]][k[2]] = 1;
+		}
+		return;
 	}
 
-	if ( !v2d_12 ) {
-		v2d_12 = ( int** ) malloc( z[1]*sizeof(int*) );
-		for ( i = 0 ; i < z[1] ; i++ ) v2d_12[i] = ( int* ) malloc ( z[2]*sizeof(int) );
+	poisson_012_begin( ctx, d, origin, z );
+	for ( i = 0 ; i < m ; i++ ) {
+		k[a] = pts[2*i];
+		k[b] = pts[2*i+1];
+		poisson_012_keep( ctx, z, k, d );
 	}
+}
 
-	if ( !v2d_20 ) {
-		v2d_20 = ( int** ) malloc( z[2]*sizeof(int*) );
-		for ( i = 0 ; i < z[2] ; i++ ) v2d_20[i] = ( int* ) malloc ( z[0]*sizeof(int) );
+static	void	poisson_012_streams( poisson_ctx *ctx, int3 z, int ***v3d, float ld, float w, float sine_portion )
+{
+	poisson_streams	st;
+	int	nt = ctx->threads < ctx->plan_n ? ctx->threads : ctx->plan_n;
+	int	i;
+	int3	origin;
+
+	st.ctx = ctx;
+	st.z = z;
+	st.ld = ld;
+	st.w = w;
+	st.sine_portion = sine_portion;
+	st.base = (unsigned long long) ( poisson_rand( ctx )*281474976710656.0 );
+	st.next = 0;
+	st.pts = ( int** ) malloc( ctx->plan_n*sizeof( int* ) );
+	st.n = ( int* ) malloc( ctx->plan_n*sizeof( int ) );
+
+#ifndef _WIN32
+	{
+		pthread_t	*tid = ( pthread_t* ) malloc( (nt > 1 ? nt : 1)*sizeof( pthread_t ) );
+		int	started = 0;
+
+		for ( i = 1 ; i < nt ; i++ ) if ( pthread_create( &tid[started], NULL, poisson_012_worker, &st ) == 0 ) started++;
+		poisson_012_worker( &st );
+		for ( i = 0 ; i < started ; i++ ) pthread_join( tid[i], NULL );
+		free( tid );
+	}
+#else
+	poisson_012_worker( &st );
+#endif
+
+	for ( i = 0 ; i < ctx->plan_n ; i++ ) {
+		origin[0] = ctx->plan[4*i+1];
+		origin[1] = ctx->plan[4*i+2];
+		origin[2] = ctx->plan[4*i+3];
+		poisson_012_list( ctx, ctx->plan[4*i], origin, z, st.pts[i], st.n[i], v3d );
+		free( st.pts[i] );
 	}
 
+	free( st.pts );
+	free( st.n );
+}
+
+int	poisson_012_gap( poisson_ctx *ctx, int3 s_0, int3 z, int ***v3d, float ld, float w, float sine_portion )
+{
+	double	t;
+	int	i;
+	int	ii;
+	int	n;
+	int	z_min;
+	int	d_min;
+
+	int3	s;
+	int3	k;
+
+	float3	fss;
 
 	for( i = 0 ; i < 3 ; i++ ) s[i] = s_0[i];
 
-	for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
-		for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) {
-			for ( k[2] = 0 ; k[2] < z[2] ; k[2]++ )	v3d[k[0]][k[1]][k[2]] = 0;
-		}	
+	if ( v3d ) {
+		for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
+			for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) {
+				for ( k[2] = 0 ; k[2] < z[2] ; k[2]++ )	v3d[k[0]][k[1]][k[2]] = 0;
+			}	
+		}
+	}
+	else {
+		ctx->sp_n = 0;
+		ctx->sp_seq = 0;
+		for ( i = 0 ; i < 4*(z[0]+z[1]+z[2]) ; i++ ) ctx->sp_plane[i] = -1;
 	}
+	ctx->plan_n = 0;
 
 	d_min = z[0] < z[1] ? 0 : 1;
 	d_min = z[d_min] < z[2] ? d_min: 2;
@@ -669,13 +1228,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_01_gap( origin, z, v2d_01, ld, w, sine_portion );
-
-				for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
-					for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
-						v3d[k[0]][k[1]][origin[2]] = v2d_01[k[0]][k[1]];
-					}
-				}
+				poisson_012_do( ctx, 2, origin, z, v3d, ld, w, sine_portion );
 
 				s[2] += 1;  // increment orthogonal dimension //
 
@@ -701,13 +1254,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_12_gap( origin, z, v2d_12, ld, w, sine_portion );
-
-				for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
-					for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
-						v3d[origin[0]][k[1]][k[2]] = v2d_12[k[1]][k[2]];
-					}
-				}
+				poisson_012_do( ctx, 0, origin, z, v3d, ld, w, sine_portion );
 
 				s[0] += 1;  // increment orthogonal dimension //
 
@@ -725,13 +1272,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_20_gap( origin, z, v2d_20, ld, w, sine_portion );
-
-				for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
-					for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
-						v3d[k[0]][origin[1]][k[2]] = v2d_20[k[2]][k[0]];
-					}
-				}
+				poisson_012_do( ctx, 1, origin, z, v3d, ld, w, sine_portion );
 
 				s[1] += 1;  // increment orthogonal dimension //
 
@@ -750,13 +1291,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_20_gap( origin, z, v2d_20, ld, w, sine_portion );
-
-				for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
-					for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
-						v3d[k[0]][origin[1]][k[2]] = v2d_20[k[2]][k[0]];
-					}
-				}
+				poisson_012_do( ctx, 1, origin, z, v3d, ld, w, sine_portion );
 
 				s[1] += 1;  // increment orthogonal dimension //
 
@@ -781,13 +1316,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_12_gap( origin, z, v2d_12, ld, w, sine_portion );
-
-				for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
-					for ( k[2] = origin[2] ; k[2] < z[2] ; k[2]++ ) {
-						v3d[origin[0]][k[1]][k[2]] = v2d_12[k[1]][k[2]];
-					}
-				}
+				poisson_012_do( ctx, 0, origin, z, v3d, ld, w, sine_portion );
 
 				s[0] += 1;  // increment orthogonal dimension //
 
@@ -805,13 +1334,7 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 				for( i = 0 ; i < 3 ; i++ ) origin[i] = s[i];
 
-				poisson_01_gap( origin, z, v2d_01, ld, w, sine_portion );
-
-				for ( k[0] = origin[0] ; k[0] < z[0] ; k[0]++ ) {
-					for ( k[1] = origin[1] ; k[1] < z[1] ; k[1]++ ) {
-						v3d[k[0]][k[1]][origin[2]] = v2d_01[k[0]][k[1]];
-					}
-				}
+				poisson_012_do( ctx, 2, origin, z, v3d, ld, w, sine_portion );
 
 				s[2] += 1;  // increment orthogonal dimension //
 
@@ -822,103 +1345,433 @@ int	poisson_012_gap( int3 s_0, int3 z, int ***v3d, float ld, float w, float sine
 
 	}
 
-	n = 0;
+	if ( ctx->threads > 0 ) poisson_012_streams( ctx, z, v3d, ld, w, sine_portion );
 
-	for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
-		for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) {
-			for ( k[2] = 0 ; k[2] < z[2] ; k[2]++ )	if ( v3d[k[0]][k[1]][k[2]] == 1 ) n += 1;
-		}	
+	t = ctx->stats ? poisson_clock() : 0;
+
+	if ( !v3d ) n = poisson_012_sparse( ctx, z, 1 );
+	else {
+		n = 0;
+		for ( k[0] = 0 ; k[0] < z[0] ; k[0]++ ) {
+			for ( k[1] = 0 ; k[1] < z[1] ; k[1]++ ) {
+				for ( k[2] = 0 ; k[2] < z[2] ; k[2]++ )	if ( v3d[k[0]][k[1]][k[2]] == 1 ) n += 1;
+			}	
+		}
 	}
 
+	if ( ctx->stats ) ctx->stats->t_count += poisson_clock()-t;
 
 	return( n );
 
 }
 
-int	main_1d( int argc, char** argv )
+//  Expected number of sampled points.
+//
+//  The gap started at a point with coordinate sum s is poisson distributed
+//  with mean lambda(s) = (ld-1)*w*sin(s/S*pi/sine_portion), exactly as in
+//  poisson_gap. For a single line the expectation is computed exactly by
+//  propagating the probability of a gap starting at each point. For planes
+//  and volumes each point is taken to be sampled with the renewal density
+//  1/(1+lambda(s)) of the line through it, which only depends on s, so the
+//  grid collapses to a histogram of coordinate sums.  //
+
+double	poisson_lambda( int s, int3 i_n, float ld, float w, float sine_portion )
 {
-	
-	int3	i_0;
-	int3	z;
-	float	seed = atof( argv[2] );  //  initial seed     //
-	int	p = atoi( argv[4] );  //  sampling points  //
-	float	sine_portion = atof( argv[3] );  //  sine portion       //
-	int	*v;                   //  vector of sampling points //
-	float	ld;
-	float	w = 2.0;              //  inital weight    //
-	int	k = 0;                //  currently found sampling points //
-	int     kk = 0; 	      //  number of sampled points final //
-	float   tol = atof( argv[5] ); // tolerance 1 = 100%, 0.01 = 1%
-	if (tol==0) {tol = 0.000001;}
-	if (seed != 0 ) {
-		srand48( seed );        	      //  initialize seed //
-		}
-	else {
-		 srand48(time(NULL));
-		}
+	if ( sine_portion == 0 ) return( (ld-1.0)*w );
 
-	z[0] = atoi( argv[6] );       //  total size       //
-	z[1] = 1;
-	z[2] = 1;
+	return( (ld-1.0)*w*sin((float)(s)/(float)(i_n[0]+i_n[1]+i_n[2]-3)*M_PI/sine_portion) );
+}
 
-	v = ( int* ) malloc( z[0]*sizeof( int ) );
+static	double	poisson_expected_1d( int3 i_n, float ld, float w, float sine_portion, double *q )
+{
+	int	x, k;
+	double	e = 0;
 
-	ld = (float)z[0]/(float)p;
+	for ( x = 0 ; x < i_n[0] ; x++ ) q[x] = 0;
+	q[0] = 1;
+
+	for ( x = 0 ; x < i_n[0] ; x++ ) {
+
+		double	l = poisson_lambda( x, i_n, ld, w, sine_portion );
+		double	kmin = l - 12.0*sqrt( l ) - 12.0;	//  poisson tails beyond these are negligible  //
+		double	kmax = l + 12.0*sqrt( l ) + 12.0;
+		double	pk;
+
+		if ( q[x] < 1e-300 ) continue;
+
+		k = kmin > 0 ? (int) kmin : 0;
+		pk = l > 0 ? q[x]*exp( -l + k*log( l ) - lgamma( k+1.0 ) ) : ( k == 0 )*q[x];
+
+		for ( ; x+k < i_n[0] && k <= kmax ; k++ ) {
+
+			e += pk;				//  gap ends inside: point sampled  //
+			if ( x+k+1 < i_n[0] ) q[x+k+1] += pk;	//  next gap starts after it  //
+
+			pk *= l/(k+1);
+		}
+	}
+
+	return( e );
+}
+
+double	poisson_expected( int ndim, int3 i_n, float ld, float w, float sine_portion )
+{
+	int	s_max = 0;
+	int	s, i;
+	double	*m;
+	double	e = 0;
+
+	if ( ndim == 1 ) {
+		m = (double*) malloc( i_n[0]*sizeof( double ) );
+		e = poisson_expected_1d( i_n, ld, w, sine_portion, m );
+		free( m );
+		return( e );
+	}
+
+	for ( i = 0 ; i < ndim ; i++ ) s_max += i_n[i]-1;
 
+	m = (double*) calloc( s_max+1, sizeof( double ) );
+
+	//  number of grid points with coordinate sum s: convolution of the axes  //
+
+	m[0] = 1;
+	for ( i = 0, s_max = 0 ; i < ndim ; i++ ) {
+		int	j;
+		for ( s = s_max+i_n[i]-1 ; s >= 0 ; s-- ) {
+			double	t = 0;
+			for ( j = 0 ; j < i_n[i] && j <= s ; j++ ) if ( s-j <= s_max ) t += m[s-j];
+			m[s] = t;
+		}
+		s_max += i_n[i]-1;
+	}
+
+	for ( s = 0 ; s <= s_max ; s++ ) e += m[s]/( 1.0 + poisson_lambda( s, i_n, ld, w, sine_portion ) );
+
+	free( m );
+
+	return( e );
+}
+
+int	poisson_weight( int ndim, int3 i_n, int tn, float ld, float sine_portion, float *w )
+{
+	double	lo = log( 1e-4 );
+	double	hi = log( 1e4 );
+	int	it;
+
+	//  the expected count falls monotonically with w: bisect on log(w)  //
+
+	if ( poisson_expected( ndim, i_n, ld, exp( hi ), sine_portion ) > tn ) return( 0 );
+	if ( poisson_expected( ndim, i_n, ld, exp( lo ), sine_portion ) < tn ) return( 0 );
+
+	for ( it = 0 ; it < 40 ; it++ ) {
+		double	mid = 0.5*( lo+hi );
+		if ( poisson_expected( ndim, i_n, ld, exp( mid ), sine_portion ) > tn ) lo = mid;
+		else hi = mid;
+	}
+
+	*w = exp( 0.5*( lo+hi ) );
+
+	return( 1 );
+}
+
+int	poisson_threads( void )
+{
+	char	*env = getenv( "POISSONV3_THREADS" );
+	int	n = env ? atoi( env ) : 0;
+
+	return( n > 0 ? n : 0 );
+}
+
+double	poisson_sparse_cells( void )
+{
+	char	*env = getenv( "POISSONV3_SPARSE" );
+
+	return( env && *env ? atof( env ) : POISSON_SPARSE_CELLS );
+}
+
+static	int	poisson_order( const void *a, const void *b )
+{
+	const	int	*p = (const int*) a;
+	const	int	*q = (const int*) b;
+
+	if ( p[2] != q[2] ) return( p[2] < q[2] ? -1 : 1 );
+	if ( p[1] != q[1] ) return( p[1] < q[1] ? -1 : 1 );
+	if ( p[0] != q[0] ) return( p[0] < q[0] ? -1 : 1 );
+
+	return( 0 );
+}
+
+int	poisson_points( poisson_ctx *ctx, int ndim, int3 z, int tn, float tol, float sine_portion, float *w, int **pts )
+{
+	int	i, k, k1, k2, k3;
+	int	n = 0;
+	int3	i_0;
+	int	*v = NULL;                   //  vector of sampling points //
+	int	**v2d = NULL;
+	int	***v3d = NULL;
+	int	*c;
+	float	ld = 1;
+	double	t = ctx->stats ? poisson_clock() : 0;
+
+	poisson_scratch( ctx, ndim, z );
+
+	switch ( ndim ) {
+		case 1 : {	v = ( int* ) malloc( z[0]*sizeof( int ) );
+				ld = (float)z[0]/(float)tn;
+			} ; break;
+		case 2 : {	v2d = ( int** ) malloc( z[0]*sizeof(int*) );
+				for ( i = 0 ; i < z[0] ; i++ ) v2d[i] = ( int* ) malloc ( z[1]*sizeof(int) );
+				ld = ( (float)z[0]*z[1] / (float) tn );
+			} ; break;
+		case 3 : {	ld = ( (float)z[0]*z[1]*z[2] / (float) tn );
+				if ( (double) z[0]*z[1]*z[2] > poisson_sparse_cells() ) break;	//  sparse path  //
+				v3d = ( int*** ) malloc( z[0]*sizeof(int**) );
+				for ( i = 0 ; i < z[0] ; i++ ) v3d[i] = ( int** ) malloc ( z[1]*sizeof(int*) );
+				for ( i = 0 ; i < z[0] ; i++ ) for ( k = 0 ; k < z[1] ; k++ ) v3d[i][k] = ( int* ) malloc ( z[2]*sizeof(int) );
+			} ; break;
+	}
+
+	ctx->tries = 0;
+
+	if ( ctx->stats ) {
+		ctx->stats->t_alloc += poisson_clock()-t;
+		ctx->stats->requested = tn;
+	}
 
 	do {
-		
+
+		if ( ctx->stats ) t = poisson_clock();
+		ctx->tries++;
 		i_0[0] = 0;                //  N.B. first point always acqured //
 		i_0[1] = 0;                //  N.B. first point always acqured //
 		i_0[2] = 0;                //  N.B. first point always acqured //
                                       //  we use the nomenclature of first point == 0 //
 
-		k = poisson_gap( 0, i_0, z, v, ld, w, sine_portion );
+		switch ( ndim ) {
+			case 1 : n = poisson_gap( ctx, 0, i_0, z, v, ld, *w, sine_portion ); break;
+			case 2 : n = poisson_01_gap( ctx, i_0, z, v2d, ld, *w, sine_portion ); break;
+			case 3 : n = poisson_012_gap( ctx, i_0, z, v3d, ld, *w, sine_portion ); break;
+		}
 
 //  if more points T.B. acquired found than than wanted: try again with weight 2% larger //
 // if fewer points T.B. acquired found than than wanted: try again with weight 2% smaller //
 
-		if ( (k <= p*(1-tol)) || (k >= p*(1+tol)) ) w *= (1.0 + 0.5*(k-p)/p);
+		if ( ctx->stats ) {
+			poisson_stats	*st = ctx->stats;
+			t = poisson_clock()-t;
+			st->t_gen += t;
+			if ( st->tries < POISSON_STATS_TRIES ) {
+				st->t_try[st->tries] = t;
+				st->w_try[st->tries] = *w;
+				st->n_try[st->tries] = n;
+			}
+			st->tries++;
+		}
+
+		if ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ) *w *= (1.0 + 0.5*(n-tn)/tn);
+
+	} while ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ); // try until correct number points to be acquired found //
 
-	} while ( (k <= p*(1-tol)) || (k >= p*(1+tol)) ); // try until correct number points to be acquired found //
+	//  coordinates in output order: the first dimension varies fastest  //
 
-	char a[k][32];
-	char point[32];
-	int index=0;
-//  print the data on standard output //
-/*	printf("# number of points = %d\n", k);i*/
-	for ( kk = 0 ; kk < k ; kk++ ) {
-		/*printf( "%d\n", v[kk] );*/
-		sprintf(point, "%4d\n", v[kk]);
-		strcpy(a[index], point);
-		index++;
+	if ( ctx->stats ) {
+		ctx->stats->w = *w;
+		ctx->stats->achieved = n;
+		t = poisson_clock();
 	}
 
-	int pool[index];	
-	int li = 0;
-	for (li = 0 ; li < index ; li++ ) {
-	        pool[li] = li;
-        }
+	c = *pts = ( int* ) malloc( (size_t) (n > 0 ? n : 1)*ndim*sizeof( int ) );
 
-	if (atoi(argv[9]) == 1) {
-		shuffle(pool, index);
+	switch ( ndim ) {
+		case 1 : {	for ( k = 0 ; k < n ; k++ ) *c++ = v[k];
+				free( v );
+			} ; break;
+		case 2 : {	for ( k2 = 0 ; k2 < z[1] ; k2++ ) {
+					for ( k1 = 0 ; k1 < z[0] ; k1++ ) {
+						if ( v2d[k1][k2] ) { *c++ = k1; *c++ = k2; }
+					}
+				}
+				for ( i = 0 ; i < z[0] ; i++ ) free( v2d[i] );
+				free( v2d );
+			} ; break;
+		case 3 : {	if ( !v3d ) {
+					qsort( ctx->sp, n, 3*sizeof( int ), poisson_order );
+					memcpy( c, ctx->sp, (size_t) n*3*sizeof( int ) );
+					break;
+				}
+				for ( k3 = 0 ; k3 < z[2] ; k3++ ) {
+					for ( k2 = 0 ; k2 < z[1] ; k2++ ) {
+						for ( k1 = 0 ; k1 < z[0] ; k1++ ) {
+							if ( v3d[k1][k2][k3] ) { *c++ = k1; *c++ = k2; *c++ = k3; }
+						}
+					}
+				}
+				for ( i = 0 ; i < z[0] ; i++ ) {
+					for ( k = 0 ; k < z[1] ; k++ ) free( v3d[i][k] );
+					free( v3d[i] );
+				}
+				free( v3d );
+			} ; break;
+	}
+
+	if ( ctx->stats ) ctx->stats->t_collect += poisson_clock()-t;
+
+	return( n );
+}
+
+static	void	poisson_put_point( FILE *fp, int ndim, const int *p )
+{
+	switch ( ndim ) {
+		case 1 : fprintf( fp, "%4d\n", p[0] ); break;
+		case 2 : fprintf( fp, "%4d %4d\n", p[0], p[1] ); break;
+		case 3 : fprintf( fp, "%4d %4d %4d\n", p[0], p[1], p[2] ); break;
+	}
+}
+
+//  Partial components: of the m = 2^(ndim-1) component combinations of the
+//  dimensions other than the last, every point acquires a random half (a
+//  partial Fisher-Yates draw), except that the first point acquires all of
+//  them. The draws follow the schedule, so its points stay those of the
+//  full schedule with the same seed.  //
+
+static	unsigned	poisson_components( poisson_ctx *ctx, int ndim, int full )
+{
+	int	m = 1 << (ndim-1);
+	int	c[4];
+	int	j, k, t;
+	unsigned	mask = ( 1u << m ) - 1;
+
+	if ( !full ) {
+		for ( j = 0 ; j < m ; j++ ) c[j] = j;
+		for ( mask = 0, j = 0 ; j < m/2 ; j++ ) {
+			k = j + (int) ( poisson_rand( ctx )*(m-j) );
+			t = c[j]; c[j] = c[k]; c[k] = t;
+			mask |= 1u << c[j];
+		}
+	}
+
+	return( mask );
+}
+
+static	void	poisson_put_components( FILE *fp, int ndim, const int *p, unsigned mask )
+{
+	int	j;
+
+	for ( j = 0 ; j < 1 << (ndim-1) ; j++ ) {
+		if ( !( mask & ( 1u << j ) ) ) continue;
+		if ( ndim == 2 ) fprintf( fp, "%4d %4d %d\n", p[0], p[1], j );
+		else fprintf( fp, "%4d %4d %4d %d\n", p[0], p[1], p[2], j );
+	}
+}
+
+//  Shuffled schedules are permuted in place on the schedule's random stream,
+//  so a seed gives one shuffled order; nothing is formatted ahead.  //
+
+void	poisson_iter_init( poisson_iter *it, poisson_ctx *ctx, int ndim, int *pts, int n, int shuffled, int keep )
+{
+	it->ctx = ctx;
+	it->pts = pts;
+	it->ndim = ndim;
+	it->n = n;
+	it->i = 0;
+	it->shuffled = shuffled;
+	it->keep = keep;
+}
+
+int	poisson_iter_next( poisson_iter *it, int max, int **pts, unsigned *comp )
+{
+	int	ndim = it->ndim;
+	int	*p = it->pts;
+	int	t[3];
+	int	i, j, k;
+
+	*pts = p + (size_t) it->i*ndim;
+
+	for ( k = 0 ; k < max && it->i < it->n ; k++, it->i++ ) {
+		i = it->i;
+
+		//  forward Fisher-Yates: point i is final once swapped, so it is handed out at once  //
+		if ( it->shuffled && i >= it->keep && i < it->n-1 ) {
+			j = i + (int) ( poisson_rand( it->ctx )*(it->n-i) );
+			if ( j != i ) {
+				memcpy( t, p+(size_t) j*ndim, ndim*sizeof( int ) );
+				memcpy( p+(size_t) j*ndim, p+(size_t) i*ndim, ndim*sizeof( int ) );
+				memcpy( p+(size_t) i*ndim, t, ndim*sizeof( int ) );
+			}
+		}
+
+		//  the components are drawn between the swaps, as they were when written one by one  //
+		if ( it->ctx->partial ) {
+			unsigned	c = poisson_components( it->ctx, ndim, i < POISSON_PC_FULL );
+			if ( comp ) comp[k] = c;
+		}
 	}
 
-	int run = 0 ;
-	for ( run = 0 ; run < index ; run++ ) {
-		int temp = pool[run];
-		printf("%s", a[pool[run]]);
-//		printf("%i\n", pool[run]);
+	return( k );
+}
+
+void	poisson_emit( poisson_ctx *ctx, FILE *fp, int ndim, int *pts, int n, int shuffled, int keep )
+{
+	double	t0 = ctx->stats ? poisson_clock() : 0;
+	poisson_iter	it;
+	unsigned	comp[POISSON_BATCH];
+	int	*p;
+	int	i, m;
+
+	poisson_iter_init( &it, ctx, ndim, pts, n, shuffled, keep );
+
+	while ( ( m = poisson_iter_next( &it, POISSON_BATCH, &p, comp ) ) > 0 ) {
+		for ( i = 0 ; i < m ; i++ ) {
+			if ( ctx->partial ) poisson_put_components( fp, ndim, p+i*ndim, comp[i] );
+			else poisson_put_point( fp, ndim, p+i*ndim );
+		}
 	}
 
+	if ( ctx->stats ) ctx->stats->t_emit += poisson_clock()-t0;
+}
+
+int	main_1d( poisson_ctx *ctx, char** argv, FILE *fp )
+{
+	
+	int3	z;
+	float	seed = atof( argv[2] );  //  initial seed     //
+	int	p = atoi( argv[4] );  //  sampling points  //
+	float	sine_portion = atof( argv[3] );  //  sine portion       //
+	int	*v;                   //  vector of sampling points //
+	float	ld;
+	float	w = 2.0;              //  inital weight    //
+	int	k = 0;                //  currently found sampling points //
+	float   tol = atof( argv[5] ); // tolerance 1 = 100%, 0.01 = 1%
+	if (tol==0) {tol = 0.000001;}
+	poisson_seed_clock( ctx, seed );	//  initialize seed //
+
+	z[0] = atoi( argv[6] );       //  total size       //
+	z[1] = 1;
+	z[2] = 1;
+
+	ld = (float)z[0]/(float)p;
+
+	//  clock seeded schedules need not be reproducible: start from the learned or expected weight  //
+	if ( seed == 0 && ctx->shape == POISSON_SINE && !wstart_lookup( 1, z, p, sine_portion, &w ) ) {
+		poisson_weight( 1, z, p, ld, sine_portion, &w );	//  new shape: start from the model  //
+	}
+
+	k = poisson_points( ctx, 1, z, p, tol, sine_portion, &w, &v );
+
+	if ( seed == 0 && ctx->shape == POISSON_SINE ) wstart_record( 1, z, p, sine_portion, w );	//  only warm-started runs feed the table  //
+
+//  print the data, shuffled in place on the schedule's own random stream  //
+	poisson_emit( ctx, fp, 1, v, k, atoi(argv[9]) == 1, 1 );
+
+	free( v );
+
 	return( 0 );
 }
 
-int	main_2d( int argc, char** argv )
+int	main_2d( poisson_ctx *ctx, char** argv, FILE *fp )
 {
 
-	int	i, k1, k2, n;
-	int3	i_0;
+	int	n;
 	int3	z;
 	float   seed = atof( argv[2] );		// input seed value
 	int	z1 = atoi( argv[6] );		// input maximum coordinate along 1st dim
@@ -926,82 +1779,41 @@ int	main_2d( int argc, char** argv )
 	int	tn = atoi( argv[4] );		// input total number of data points in schedule  < z1 * z2
 	float	sine_portion = atof( argv[3] ); //  sine portion       //
 	float   w = 2.0; 	                //  inital weight    //
-	int	**v2d;
+	int	*v;
 	float	ld;
 	float	tol = atof( argv[5] ); // tolerance 1 = 100%, 0.01 = 1%
 
 	if (tol==0) {tol = 0.000001;}
-        if (seed != 0 ) {
-                srand48( seed );                      //  initialize seed //
-                }
-        else {
-                 srand48(time(NULL));
-                }
+	poisson_seed_clock( ctx, seed );	//  initialize seed //
 
 	z[0] = z1;
 	z[1] = z2;
 	z[2] = 0;
 
-	v2d = ( int** ) malloc( z1*sizeof(int*) );
-		for ( i = 0 ; i < z1 ; i++ ) v2d[i] = ( int* ) malloc ( z2*sizeof(int) );
-
 	ld = ( (float)z[0]*z[1] / (float) tn );
 
-	do {
-
-		i_0[0] = 0;                //  N.B. first point always acqured //
-		i_0[1] = 0;                //  N.B. first point always acqured //
-		i_0[2] = 0;                //  N.B. first point always acqured //
-		n = poisson_01_gap( i_0, z, v2d, ld, w, sine_portion );
-
-		//printf("%i\n", n);
-
-
-		if ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ) w *= (1.0 + 0.5*(n-tn)/tn);
-
-	} while ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ); // try until correct number points to be acquired found // 
+	//  clock seeded schedules need not be reproducible: start from the learned or expected weight  //
+	if ( seed == 0 && ctx->shape == POISSON_SINE && !wstart_lookup( 2, z, tn, sine_portion, &w ) ) {
+		poisson_weight( 2, z, tn, ld, sine_portion, &w );	//  new shape: start from the model  //
+	}
 
+	n = poisson_points( ctx, 2, z, tn, tol, sine_portion, &w, &v );
 
-	char a[n][32];
-	char point[32];
-	int index = 0;
-	for ( k2 = 0 ; k2 < z2 ; k2++ ) {
-		for ( k1 = 0 ; k1 < z1 ; k1++ ) {
-			if ( v2d[k1][k2] ) {
-		//		printf( "%4d %4d\n", k1, k2); 
-				sprintf(point,"%4d %4d\n", k1, k2);
-				strcpy(a[index], point);
-				index++;
-			}
-		}
-	}
+	if ( seed == 0 && ctx->shape == POISSON_SINE ) wstart_record( 2, z, tn, sine_portion, w );	//  only warm-started runs feed the table  //
 
 
-	int pool[index];	
-	int li = 0;
-	for (li = 0 ; li < index ; li++ ) {
-	        pool[li] = li;
-        }
+	poisson_emit( ctx, fp, 2, v, n, atoi(argv[9]) == 1, 1 );
 
-	if (atoi(argv[9]) == 1) {
-		shuffle(pool, index);
-	}
-	int run = 0 ;
-	for ( run = 0 ; run < index ; run++ ) {
-		int temp = pool[run];
-		printf("%s", a[pool[run]]);
-//		printf("%i\n", pool[run]);
-	}
+	free( v );
 
 	return( 0 );
 }
 
 
-int	main_3d( int argc, char** argv )
+int	main_3d( poisson_ctx *ctx, char** argv, FILE *fp )
 {
 
-	int	i, k, k1, k2, k3, n;
-	int3	i_0;
+	int	n;
 	int3	z;
 	float   seed = atof( argv[2] );		// input seed value
 	float	w = 1.0;
@@ -1010,98 +1822,363 @@ int	main_3d( int argc, char** argv )
 	int	z3 = atoi( argv[8] );		// input maximum coordinate along 2nd dim
 	int	tn = atoi( argv[4] );		// input total number of data points in schedule  < z1 * z2
 	float	sine_portion = atof( argv[3] );  //  sine portion       //
-	int	***v3d;
+	int	*v;
 	float	ld;
-	FILE	*fp;
 
 	float   tol = atof( argv[5] ); // tolerance 1 = 100%, 0.01 = 1%
 
         if (tol==0) {tol = 0.000001;}
-        if (seed != 0 ) {
-                srand48( seed );                      //  initialize seed //
-                }
-        else {
-                 srand48(time(NULL));
-                }
+	poisson_seed_clock( ctx, seed );	//  initialize seed //
 
 
 	z[0] = z1;
 	z[1] = z2;
 	z[2] = z3;
 
-	v3d = ( int*** ) malloc( z1*sizeof(int**) );
+	ld = ( (float)z[0]*z[1]*z[2] / (float) tn );
 
-	for ( i = 0 ; i < z1 ; i++ ) v3d[i] = ( int** ) malloc ( z2*sizeof(int*) );
+	//  clock seeded schedules need not be reproducible: start from the learned or expected weight  //
+	if ( seed == 0 && ctx->shape == POISSON_SINE && !wstart_lookup( 3, z, tn, sine_portion, &w ) ) {
+		poisson_weight( 3, z, tn, ld, sine_portion, &w );	//  new shape: start from the model  //
+	}
 
-	for ( i = 0 ; i < z1 ; i++ ) for ( k = 0 ; k < z2 ; k++ ) v3d[i][k] = ( int* ) malloc ( z3*sizeof(int) );
+	n = poisson_points( ctx, 3, z, tn, tol, sine_portion, &w, &v );
 
-	ld = ( (float)z[0]*z[1]*z[2] / (float) tn );
+	if ( seed == 0 && ctx->shape == POISSON_SINE ) wstart_record( 3, z, tn, sine_portion, w );	//  only warm-started runs feed the table  //
 
-	do {
 
-		i_0[0] = 0;                //  N.B. first point always acqured //
-		i_0[1] = 0;                //  N.B. first point always acqured //
-		i_0[2] = 0;                //  N.B. first point always acqured //
 
-		n = poisson_012_gap( i_0, z, v3d, ld, w, sine_portion );
+	poisson_emit( ctx, fp, 3, v, n, atoi(argv[9]) == 1, 1 );
 
-		if ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ) w *= (1.0 + 0.5*(n-tn)/tn);
+	free( v );
 
-	}  while ( (n <= tn*(1-tol)) || (n >= tn*(1+tol)) ); // try until correct number points to be acquired found //;
+	return( 0 );
 
+}
 
 
-	char a[n][32];
-	char point[32];
-	int index = 0;
-	for ( k3 = 0 ; k3 < z3 ; k3++ ) {
-		for ( k2 = 0 ; k2 < z2 ; k2++ ) {
-			for ( k1 = 0 ; k1 < z1 ; k1++ ) {
-				if ( v3d[k1][k2][k3] ) {
-				//	printf( "%4d %4d %4d\n", k1, k2, k3);
-					sprintf(point, "%4d %4d %4d\n", k1, k2, k3);
-					strcpy(a[index], point);
-					index++;
-				}
+//  Nested schedules: every level adds to the points of the level before it
+//  (or of the file extended) the new points of a Poisson gap schedule drawn
+//  on the whole grid. Its size is raised until the union reaches the level;
+//  a union past the tolerance loses random new points down to the level.
+//  The first level of a run without a file is the plain schedule.  //
+
+static	long long	poisson_key( int ndim, int3 z, const int *p )
+{
+	return( ( (long long) ( ndim > 2 ? p[2] : 0 )*z[1] + ( ndim > 1 ? p[1] : 0 ) )*z[0] + p[0] );
+}
+
+static	int	poisson_key_order( const void *a, const void *b )
+{
+	long long	p = *(const long long*) a;
+	long long	q = *(const long long*) b;
+
+	return( p < q ? -1 : p > q );
+}
+
+//  the first ndim numbers of every non-empty line; anything after them is ignored  //
+
+static	int	poisson_read_schedule( const char *file, int ndim, int3 z, int **pts )
+{
+	FILE	*fi = fopen( file, "r" );
+	char	line[256];
+	char	*c, *end;
+	int	n = 0;
+	int	max = 1024;
+	int	d;
+
+	if ( !fi ) {
+		fprintf( stderr, "Cannot read schedule %s\n", file );
+		return( -1 );
+	}
+
+	*pts = ( int* ) malloc( max*ndim*sizeof( int ) );
+
+	while ( fgets( line, sizeof( line ), fi ) ) {
+		for ( c = line ; *c == ' ' || *c == '\t' ; c++ );
+		if ( *c == '\n' || *c == '\r' || *c == 0 ) continue;
+		if ( n == max ) {
+			max *= 2;
+			*pts = ( int* ) realloc( *pts, (size_t) max*ndim*sizeof( int ) );
+		}
+		for ( d = 0 ; d < ndim ; d++ ) {
+			long	x = strtol( c, &end, 10 );
+			if ( end == c || x < 0 || x >= z[d] ) {
+				fprintf( stderr, "Point %d of %s is not on the grid\n", n+1, file );
+				fclose( fi );
+				free( *pts );
+				return( -1 );
 			}
+			(*pts)[n*ndim+d] = (int) x;
+			c = end;
 		}
+		n++;
 	}
 
-	int pool[index];
-	int li;
-	for (li = 0; li < index; li++) {
-		pool[li] = li ;
-	}
-	if (atoi(argv[9]) == 1) {
-		shuffle(pool, index);
+	fclose( fi );
+
+	return( n );
+}
+
+int	main_nested( poisson_ctx *ctx, char **argv, int *tn, int levels, const char *file, FILE *fp )
+{
+	int	ndim = atoi( argv[1] );
+	float	seed = atof( argv[2] );
+	float	sine_portion = atof( argv[3] );
+	float	tol = atof( argv[5] );
+	int3	z;
+	long long	grid = 1;
+	long long	*keys;
+	int	*base = NULL;
+	int	*pts, *fresh;
+	int	nb = 0;
+	int	nk = 0;
+	int	g, m, nf, i, l;
+	float	w;
+
+	if ( tol == 0 ) tol = 0.000001;
+
+	z[0] = atoi( argv[6] );
+	z[1] = ndim > 1 ? atoi( argv[7] ) : 1;
+	z[2] = ndim > 2 ? atoi( argv[8] ) : ( ndim == 2 ? 0 : 1 );
+	for ( i = 0 ; i < ndim ; i++ ) grid *= z[i];
+
+	if ( file && ( nb = poisson_read_schedule( file, ndim, z, &base ) ) < 0 ) return( -1 );
+
+	if ( tn[levels-1] > grid ) {
+		fprintf( stderr, "Level %d (%d points) does not fit a grid of %lld\n", levels, tn[levels-1], grid );
+		free( base );
+		return( -1 );
 	}
-	int run;
-	for (run = 0; run < index; run++) {
-		printf("%s", a[pool[run]]);
+
+	poisson_seed_clock( ctx, seed );
+
+	keys = ( long long* ) malloc( (size_t) ( nb+1 )*sizeof( long long ) );
+	for ( i = 0 ; i < nb ; i++ ) keys[nk++] = poisson_key( ndim, z, base+i*ndim );
+	qsort( keys, nk, sizeof( long long ), poisson_key_order );
+	for ( m = nb, nb = 0, i = 0 ; i < nk ; i++ ) if ( i == 0 || keys[i] != keys[i-1] ) keys[nb++] = keys[i];
+	nk = nb;
+
+	//  the file's points first, as they are: they may be acquired already  //
+
+	if ( tn[0] > nb ) for ( i = 0 ; i < m ; i++ ) poisson_put_point( fp, ndim, base+i*ndim );
+	free( base );
+
+	for ( l = 0 ; l < levels ; l++ ) {
+		if ( tn[l] <= nb ) {
+			fprintf( stderr, "Level %d (%d points) does not add to the %d points before it\n", l+1, tn[l], nb );
+			free( keys );
+			return( -1 );
+		}
+
+		w = ndim == 3 ? 1.0 : 2.0;
+		g = tn[l] - nb;
+
+		for (;;) {
+			m = poisson_points( ctx, ndim, z, g, tol, sine_portion, &w, &pts );
+
+			fresh = ( int* ) malloc( (size_t) ( m > 0 ? m : 1 )*ndim*sizeof( int ) );
+			for ( nf = 0, i = 0 ; i < m ; i++ ) {
+				long long	k = poisson_key( ndim, z, pts+i*ndim );
+				if ( bsearch( &k, keys, nk, sizeof( long long ), poisson_key_order ) ) continue;
+				memcpy( fresh+nf*ndim, pts+i*ndim, ndim*sizeof( int ) );
+				nf++;
+			}
+			free( pts );
+
+			if ( nb+nf >= tn[l]*(1-tol) || g >= grid ) break;
+
+			free( fresh );
+			g += tn[l] - (nb+nf);		//  the points the union fell short by  //
+			if ( g > grid ) g = grid;
+		}
+
+		while ( nb+nf > tn[l]*(1+tol) ) {	//  past the tolerance: drop random new points  //
+			i = (int) ( poisson_rand( ctx )*nf );
+			memmove( fresh+i*ndim, fresh+(i+1)*ndim, (size_t) (nf-i-1)*ndim*sizeof( int ) );
+			nf--;
+		}
+
+		keys = ( long long* ) realloc( keys, (size_t) ( nk+nf+1 )*sizeof( long long ) );
+		poisson_emit( ctx, fp, ndim, fresh, nf, atoi( argv[9] ) == 1, nb == 0 );	//  the origin stays first  //
+
+		for ( i = 0 ; i < nf ; i++ ) keys[nk++] = poisson_key( ndim, z, fresh+i*ndim );
+		qsort( keys, nk, sizeof( long long ), poisson_key_order );
+		nb += nf;
+
+		if ( ctx->stats ) {
+			ctx->stats->level_n[l] = nb;
+			ctx->stats->levels = l+1;
+		}
+
+		free( fresh );
 	}
 
+	free( keys );
+
 	return( 0 );
+}
+
+double	poisson_clock( void )
+{
+	struct	timespec	ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return( ts.tv_sec + 1e-9*ts.tv_nsec );
+}
+
+void	poisson_stats_print( poisson_stats *st, FILE *fp )
+{
+	int	i;
+
+	fprintf( fp, "{\"w\":%.6g,\"requested\":%d,\"achieved\":%d,\"cached\":%s,\n", st->w, st->requested, st->achieved, st->cached ? "true" : "false" );
+	fprintf( fp, " \"seconds\":{\"total\":%.6f,\"allocation\":%.6f,\"generation\":%.6f,\"counting\":%.6f,\"collection\":%.6f,\"shuffle_and_emission\":%.6f},\n",
+		st->t_total, st->t_alloc, st->t_gen-st->t_count, st->t_count, st->t_collect, st->t_emit );
+	fprintf( fp, " \"weight_iterations\":%d,\"iterations\":[", st->tries );
+	for ( i = 0 ; i < st->tries && i < POISSON_STATS_TRIES ; i++ ) {
+		fprintf( fp, "%s{\"w\":%.6g,\"points\":%d,\"seconds\":%.6f}", i ? "," : "", st->w_try[i], st->n_try[i], st->t_try[i] );
+	}
+	fprintf( fp, "],\n \"poisson_calls\":%lld,\"uniforms\":%lld,\"backtrack_steps\":%lld", st->calls, st->uniforms, st->back );
+	if ( st->levels ) {
+		fprintf( fp, ",\"levels\":[" );
+		for ( i = 0 ; i < st->levels ; i++ ) fprintf( fp, "%s%d", i ? "," : "", st->level_n[i] );
+		fprintf( fp, "]" );
+	}
+	fprintf( fp, "}\n" );
+}
+
+int	poisson_request( poisson_ctx *ctx, char** argv, FILE *fp )
+{
+	int	numdim = atoi(argv[1]);
+	int	status = 0;
+	char	key[17];
+	char	tmp[PATH_MAX];
+	int	served;
+	FILE	*fpc = NULL;
+	FILE	*fpout = fp;
+	int	shuffled;
+	int	tn[POISSON_LEVELS];
+	const	char	*file;
+	int	levels;
+
+	if ( numdim < 1 || numdim > 3 ) {
+		fprintf( stderr, "Must make 1, 2 or 3 poisson gap dimensions\n" );
+		return( -1 );
+	}
+
+	if ( poisson_shape_parse( argv[3], &ctx->shape, ctx->shape_a ) ) {
+		fprintf( stderr, "Unknown sine portion or density %s (exp:a with 0 < a <= 50, qsine:o with 0 <= o < 1, gauss:s with 0.05 <= s <= 10, decay:r1,r2,r3 with 0 <= r <= 10)\n", argv[3] );
+		return( -1 );
+	}
+
+	if ( poisson_order_parse( argv[9], &shuffled, &ctx->partial ) ) {
+		fprintf( stderr, "Unknown order %s (0 or 1, followed by :pc for partial components)\n", argv[9] );
+		return( -1 );
+	}
+	if ( ctx->partial && numdim < 2 ) {
+		fprintf( stderr, "Partial components need 2 or 3 dimensions\n" );
+		return( -1 );
+	}
+
+	levels = poisson_levels_parse( argv[4], tn, &file );
+	if ( levels < 0 ) {
+		fprintf( stderr, "Unknown number of points %s (n, or rising n1,n2,... up to %d levels, optionally @file)\n", argv[4], POISSON_LEVELS );
+		return( -1 );
+	}
+	if ( ctx->partial && ( levels > 1 || file ) ) {
+		fprintf( stderr, "Partial components can not be combined with nested schedules\n" );
+		return( -1 );
+	}
 
+	ctx->threads = poisson_threads();
+
+	//  a rerun with the same seed and parameters is replayed from the cache  //
+
+	if ( cache_key( argv, key ) == 0 ) {
+		served = cache_serve( key, fp );
+		if ( served < 0 ) {
+			fprintf( stderr, "Cannot copy the cached schedule %s\n", key );
+			return( -1 );		//  part of it is out: generating now would append a second schedule  //
+		}
+		if ( served ) {
+			if ( ctx->stats ) ctx->stats->cached = 1;
+			return( 0 );
+		}
+		fpc = cache_begin( key, tmp );
+		if ( fpc ) fpout = fpc;
+	}
+
+	if ( levels > 1 || file ) status = main_nested( ctx, argv, tn, levels, file, fpout );
+	else switch ( numdim ) {
+		case 1 : { status = main_1d( ctx, argv, fpout ); break; }
+		case 2 : { status = main_2d( ctx, argv, fpout ); break; }
+		case 3 : { status = main_3d( ctx, argv, fpout ); break; }
+	}
+
+	if ( fpc && cache_commit( fpc, tmp, key, fp ) ) return( -1 );
+
+	return( status );
 }
 
 
+#ifndef POISSON_LIBRARY	//  gap_sampler and the bindings link the generator without this main  //
+
 int	main( int argc, char** argv )
 {
 	int	status;
+	poisson_stats	stats;
+	int	with_stats = 0;
+	const	char	*out = NULL;
+	char	tmp[PATH_MAX];
+	FILE	*fp = stdout;
+
+	//  --version: the AU macros ask for it to tell this build from ones without --out  //
+
+	if ( argc == 2 && strcmp( argv[1], "--version" ) == 0 ) {
+		printf( "poissonv3 %d\n", POISSON_GEN_VERSION );
+		exit( 0 );
+	}
+
+	if ( argc >= 2 && strcmp( argv[1], "--serve" ) == 0 ) {
+		exit( serve_run( argc > 2 ? argv[2] : NULL ) ? -1 : 0 );
+	}
+
+	for (;;) {
+
+		//  --stats: timings and counters as JSON on stderr; the run stays in this process  //
+
+		if ( argc >= 2 && strcmp( argv[1], "--stats" ) == 0 ) {
+			argv[1] = argv[0];
+			argv++;
+			argc--;
+			with_stats = 1;
+		}
+
+		//  --out file: the schedule replaces file once it is complete (a failed run leaves no file behind)  //
+
+		else if ( argc >= 3 && strcmp( argv[1], "--out" ) == 0 ) {
+			out = argv[2];
+			argv[2] = argv[0];
+			argv += 2;
+			argc -= 2;
+		}
+		else break;
+	}
 
 	if ( argc != 10 ) {
 		fprintf( stderr, "Wrong number of arguments (%d provided, 9 required).\n\n", argc-1);
 		
-		fprintf( stderr, "Expected arguments:\n");
+		fprintf( stderr, "Expected arguments (after --stats for timings and counters on stderr, --out file to write file; or --version alone):\n");
 		fprintf( stderr, "1) number of NUS dimensions (1, 2, or 3)\n");
 		fprintf( stderr, "2) seed num (0 means seed based on execution time)\n");
-		fprintf( stderr, "3) sine portion (2, 1 or 0. 1 and 0 are not practical)\n");
-		fprintf( stderr, "4) number of sampled points\n");
+		fprintf( stderr, "3) sine portion (2, 1 or 0. 1 and 0 are not practical) or density (exp:a, qsine:o, gauss:s, decay:r1,r2,r3)\n");
+		fprintf( stderr, "4) number of sampled points (or rising n1,n2,... for nested schedules, @file to extend one)\n");
 		fprintf( stderr, "5) tolerance (1 = 100%%)\n");
 		fprintf( stderr, "6) total size of dimension 1 (the full range)\n");
 		fprintf( stderr, "7) total size of dimension 2 (the full range)\n");
 		fprintf( stderr, "8) total size of dimension 3 (the full range)\n");
-		fprintf( stderr, "9) 0 = in order, 1 = shuffled\n\n");
+		fprintf( stderr, "9) 0 = in order, 1 = shuffled (0:pc or 1:pc for partial quadrature components)\n\n");
 		
 		fprintf( stderr, "Received arguments:\n");
 		fprintf( stderr, "0) %s (program name)\n", argv[0]);
@@ -1112,18 +2189,42 @@ int	main( int argc, char** argv )
 		exit( -1 );
 	}
 	else {
-		int numdim = atoi(argv[1]);
-
-		switch ( numdim ) {
-			case 1 : { status = main_1d( argc, argv ); break; }
-			case 2 : { status = main_2d( argc, argv ); break; }
-			case 3 : { status = main_3d( argc, argv ); break; }
-			default: { fprintf( stderr, "Must make 1, 2 or 3 poisson gap dimensions\n" );
-					exit( -1 );
-			 	}
+		poisson_ctx	ctx;
+
+		if ( out && !( fp = replace_begin( out, tmp ) ) ) {
+			fprintf( stderr, "Cannot write %s\n", out );
+			exit( -1 );
+		}
+
+		//  hand the request to a running poissonv3 --serve if there is one  //
+
+		status = with_stats ? -1 : serve_request( argv, fp );
+		if ( status < 0 ) {
+			poisson_ctx_init( &ctx );
+			if ( with_stats ) {
+				memset( &stats, 0, sizeof( stats ) );
+				ctx.stats = &stats;
+				stats.t_total = poisson_clock();
+			}
+			status = poisson_request( &ctx, argv, fp );
+			if ( with_stats ) {
+				fflush( fp );
+				stats.t_total = poisson_clock()-stats.t_total;
+				poisson_stats_print( &stats, stderr );
+			}
+			poisson_ctx_free( &ctx );
 		}
+
+		if ( out && replace_commit( fp, tmp, out, status == 0 ) && status == 0 ) {
+			fprintf( stderr, "Cannot write %s\n", out );
+			status = -1;
+		}
+
+		if ( status ) exit( -1 );
 	}
 
 
 	exit( 0 );
 }
+
+#endif
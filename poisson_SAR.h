@@ -4,42 +4,264 @@ typedef	int	int3[3];
 
 typedef	float	float3[3];
 
-// input: lamda of the poission distribution; return: a poission random number
+// 3D grids with more points than this are generated on the sparse path, which
+// keeps the sampled points instead of the whole volume (POISSONV3_SPARSE overrides)
 
-int	poisson( double );
+#define	POISSON_SPARSE_CELLS	( 1 << 22 )
 
+// density shapes (argument 3: a sine portion, or exp:a, qsine:o, gauss:s or decay:r1,r2,r3)
 
-// input: direction (dimension), i_0 (init coordinates), i_n (size of 3D matrix),
+#define	POISSON_SINE	0	// sin(t*pi/sine_portion), the original weighting //
+#define	POISSON_EXP	1	// (exp(a*t)-1)/(exp(a)-1): exponential decay of the density //
+#define	POISSON_QSINE	2	// sin((o+(1-o)*t)*pi/2): quarter sine starting at offset o //
+#define	POISSON_GAUSS	3	// (exp(t^2/2s^2)-1)/(exp(1/2s^2)-1): gaussian tail of the density //
+#define	POISSON_DECAY	4	// density matched to exp(-(r1*x1+r2*x2+r3*x3)), r per increment, 0 if constant time //
+
+// partial components (argument 9: 0:pc or 1:pc). Each point lists the quadrature
+// components it acquires, one line each, with the component as the last column:
+// bit d of it set for the imaginary part of dimension d+1. The last dimension is
+// always acquired in full (L 3 of the macros), so a component names the parts of
+// the others and half of their 2^(ndim-1) combinations are acquired per point.
+
+#define	POISSON_PC_FULL	1	// the first point acquires every component //
+
+// nested schedules (argument 4: rising counts n1,n2,... and/or @file of points to
+// extend). Each level holds the one before it; its new points follow them.
+
+#define	POISSON_LEVELS	16	// most levels in one run //
+
+// --stats: timings and counters of one run, written to stderr as JSON. The
+// generator only updates them when ctx->stats is set, once per line or phase.
+
+#define	POISSON_STATS_TRIES	64	// weight iterations timed one by one //
+
+typedef	struct {
+	double	t_alloc;		// scratch and schedule arrays //
+	double	t_total;		// seconds: the whole request //
+	double	t_gen;			// the weight iterations, counting included //
+	double	t_count;		// counting the sampled points //
+	double	t_collect;		// copying them out in grid order //
+	double	t_emit;			// shuffle and output, which run together //
+	double	t_try[POISSON_STATS_TRIES];	// each weight iteration //
+	float	w_try[POISSON_STATS_TRIES];	// its weight //
+	int	n_try[POISSON_STATS_TRIES];	// and its points //
+	int	tries;
+	long long	calls;		// gaps drawn (poisson() calls) //
+	long long	uniforms;	// uniform numbers they took (as one at a time) //
+	long long	back;		// steps of the origin backtracking of the lines //
+	float	w;			// weight converged on //
+	int	requested;
+	int	achieved;
+	int	cached;			// replayed from the schedule cache //
+	int	levels;			// nested runs: number of levels //
+	int	level_n[POISSON_LEVELS];	// and the points of each //
+} poisson_stats;
+
+// generator context: random number state and scratch space of one schedule.
+// Contexts are independent, so schedules may be generated concurrently.
+
+typedef	struct {
+	unsigned long long	x;	// drand48 compatible 48 bit state //
+	int	*v;			// one line //
+	int	v_max;
+	int3	zs;			// size the planes are allocated for //
+	int	**v2d_01;		// planes used by poisson_012_gap //
+	int	**v2d_12;
+	int	**v2d_20;
+	int	s_off;			// added to coordinate sums in the sine weighting //
+	int	s_den;			// if not 0, replaces the sine denominator i_n[0]+i_n[1]+i_n[2]-3 //
+	int	*sp;			// sparse path: points written by the planes, 4 ints each //
+	size_t	sp_n;
+	size_t	sp_max;
+	int	*sp_plane;		// sparse path: order written and origin of every plane //
+	int	sp_seq;			// sparse path: planes written so far //
+	int	threads;		// 3D: 0 for the single random stream, else threads generating planes on streams of their own //
+	int	*plan;			// planes of the 3D sweep in order: orientation and origin //
+	int	plan_n;
+	int	lanes;			// if not 0, gaps come from the lane sampler (poisson_simd.c) //
+	unsigned long long	lane[16];	// its state //
+	int	shape;			// density shape, POISSON_SINE unless argument 3 names another //
+	float	shape_a[3];		// its parameter, or the decay rates of the 3 dimensions //
+	double	*ax[3];			// decay: exp(r*x) along each dimension //
+	int	ax_n[3];
+	float	ax_r[3];
+	int	tries;			// schedules drawn by the weight search of poisson_points //
+	poisson_stats	*stats;		// if not NULL, --stats timings and counters //
+	int	partial;		// if not 0, each point acquires only some quadrature components //
+	double	*lt;			// exp(-lamda) by coordinate sum for the parameters below //
+	int	lt_n;
+	float	lt_key[7];		// ld, w, sine_portion, sine denominator, s_off, shape, shape_a //
+} poisson_ctx;
+
+// input: ctx; return: nothing (ctx is emptied, nothing allocated)
+
+void	poisson_ctx_init( poisson_ctx* );
+
+void	poisson_ctx_free( poisson_ctx* );
+
+// input: ctx, ndim (number of NUS dimensions), z (size of 3D matrix)
+// return: nothing (scratch space of ctx is made large enough for z)
+
+void	poisson_scratch( poisson_ctx*, int, int3 );
+
+// input: ctx, seed (as srand48; poisson_seed_clock uses the clock for seed 0)
+// return: nothing
+
+void	poisson_seed( poisson_ctx*, long );
+
+void	poisson_seed_clock( poisson_ctx*, float );
+
+// input: ctx; return: uniform random number in [0,1), the drand48 sequence
+
+double	poisson_rand( poisson_ctx* );
+
+// point iterator: the points of a finished schedule in output order, handed out
+// in batches as the shuffle places them, so that a consumer starts on the first
+// points before the last are placed. It works on the schedule's own array and
+// random stream, and gives the order (and components) poisson_emit writes.
+
+#define	POISSON_BATCH	1024	// points poisson_emit takes per batch //
+
+typedef	struct {
+	poisson_ctx	*ctx;		// random stream of the shuffle and components //
+	int	*pts;			// the schedule, ndim coordinates per point, shuffled in place //
+	int	ndim;
+	int	n;
+	int	i;			// next point //
+	int	shuffled;
+	int	keep;			// leading points that are never moved //
+} poisson_iter;
+
+// input: it (*updated*), ctx, ndim, pts (n points, ndim coordinates each, owned by
+// the caller and *updated* as the iterator runs), n, shuffled (0 = in order),
+// keep (leading points that are never moved)
+// return: nothing
+
+void	poisson_iter_init( poisson_iter*, poisson_ctx*, int, int*, int, int, int );
+
+// input: it (*updated*), max (most points wanted), pts (*updated*, set to the
+// first point of the batch, which stays valid until the iterator's array is
+// freed), comp (NULL, or max masks *updated* with the components of every point
+// when ctx->partial is set: bit j for component j)
+// return: number of points in the batch, 0 when the schedule is done
+
+int	poisson_iter_next( poisson_iter*, int, int**, unsigned* );
+
+// input: ctx, fp, ndim, pts (n points, ndim coordinates each, *updated*: shuffled in place),
+// n, shuffled (0 = in order), keep (leading points that are never moved)
+// return: nothing (the points are written as the iterator hands them out, with their
+// components when ctx->partial is set)
+
+void	poisson_emit( poisson_ctx*, FILE*, int, int*, int, int, int );
+
+// input: arg (argument 3 of poissonv3), shape, a (3 parameters, *updated*)
+// return: 0, -1 if arg is neither a number nor a valid density shape
+
+int	poisson_shape_parse( const char*, int*, float* );
+
+// input: arg (argument 9 of poissonv3), shuffled, partial (*updated*)
+// return: 0, -1 if arg is not 0 or 1, optionally followed by :pc
+
+int	poisson_order_parse( const char*, int*, int* );
+
+// input: arg (argument 4 of poissonv3), tn (POISSON_LEVELS counts, *updated*),
+// file (*updated*, the schedule to extend or NULL)
+// return: number of levels, -1 if arg is not a rising list of positive counts
+
+int	poisson_levels_parse( const char*, int*, const char** );
+
+// input: ctx, lamda of the poission distribution; return: a poission random number
+
+int	poisson( poisson_ctx*, double );
+
+
+// input: ctx, direction (dimension), i_0 (init coordinates), i_n (size of 3D matrix),
 // v (1d vector of poisson gap sampling, *updated*), ld (lamda), w (weight),
 // sine_portion (weight for sine function)
 // return: number of sampled points
 
-int	poisson_gap( int, int3, int3, int*, float, float, float );
+int	poisson_gap( poisson_ctx*, int, int3, int3, int*, float, float, float );
 
-// input: i_0 (init coordinates), i_n (size of 3D matrix),
+// input: ctx, i_0 (init coordinates), i_n (size of 3D matrix),
 // v2d (2d vector of poisson gap sampling, *updated*), ld (lamda), w (weight),
 // sine_portion (weight for sine function)
 // return: number of sampled points
 
-int	poisson_01_gap( int3, int3, int**, float, float, float );
+int	poisson_01_gap( poisson_ctx*, int3, int3, int**, float, float, float );
 
-int	poisson_12_gap( int3, int3, int**, float, float, float );
+int	poisson_12_gap( poisson_ctx*, int3, int3, int**, float, float, float );
 
-int	poisson_20_gap( int3, int3, int**, float, float, float );
+int	poisson_20_gap( poisson_ctx*, int3, int3, int**, float, float, float );
 
-// input: i_0 (init coordinates), i_n (size of 3D matrix),
-// v3d (3d vector of poisson gap sampling, *updated*), ld (lamda), w (weight),
+// input: ctx, i_0 (init coordinates), i_n (size of 3D matrix),
+// v3d (3d vector of poisson gap sampling, *updated*; NULL for the sparse path, which leaves
+// the sampled points in ctx->sp, 3 ints each), ld (lamda), w (weight),
 // sine_portion (weight for sine function)
 // return: number of sampled points
 
-int	poisson_012_gap( int3, int3, int***, float, float, float );
+int	poisson_012_gap( poisson_ctx*, int3, int3, int***, float, float, float );
 
-// input: argc (number of argv variables), argv (array of strings)
-// return: nothing
+// input: nothing
+// return: threads for 3D schedules on plane streams (POISSONV3_THREADS), 0 for the single stream
+
+int	poisson_threads( void );
+
+// input: nothing
+// return: number of grid points above which 3D schedules take the sparse path
+
+double	poisson_sparse_cells( void );
+
+// input: ctx (seeded), ndim, z (size of 3D matrix, z[2] = 0 for 2D and z[1] = z[2] = 1 for 1D),
+// tn (number of sampled points wanted), tol (tolerance 1 = 100%), sine_portion,
+// w (initial weight, *updated* with the weight the search converged on),
+// pts (*updated*, malloc'ed ndim coordinates per point, first dimension fastest)
+// return: number of sampled points
+
+int	poisson_points( poisson_ctx*, int, int3, int, float, float, float*, int** );
+
+// input: s (coordinate sum), i_n (size of 3D matrix), ld, w, sine_portion
+// return: mean of the gap started at a point with coordinate sum s
+
+double	poisson_lambda( int, int3, float, float, float );
+
+// input: ndim (number of NUS dimensions), i_n (size of 3D matrix), ld (lamda), w (weight),
+// sine_portion (weight for sine function)
+// return: expected number of sampled points (exact for 1D, mean field for 2D and 3D)
+
+double	poisson_expected( int, int3, float, float, float );
+
+// input: ndim, i_n, tn (number of sampled points wanted), ld, sine_portion,
+// w (weight, *updated*)
+// return: 1 if a weight giving tn expected points was found, 0 otherwise
+
+int	poisson_weight( int, int3, int, float, float, float* );
+
+// input: ctx, argv (program name and the 9 positional arguments),
+// fp (stream the schedule is printed to)
+// return: 0
+
+int	main_1d( poisson_ctx*, char**, FILE* );
+
+int	main_2d( poisson_ctx*, char**, FILE* );
+
+int	main_3d( poisson_ctx*, char**, FILE* );
+
+// input: ctx, argv, tn (counts of the levels), levels (number of levels),
+// file (schedule to extend or NULL), fp (stream the schedule is printed to)
+// return: 0, -1 if the file can not be read or the levels do not fit
+
+int	main_nested( poisson_ctx*, char**, int*, int, const char*, FILE* );
+
+// input: nothing; return: seconds on a monotonic clock
+
+double	poisson_clock( void );
+
+// input: stats, fp; return: nothing (stats are printed as one JSON record)
 
-int	main_1d( int, char** );
+void	poisson_stats_print( poisson_stats*, FILE* );
 
-int	main_2d( int, char** );
+// input: ctx, argv (program name and the 9 positional arguments), fp
+// return: 0 on success, -1 on bad arguments or output errors
 
-int	main_3d( int, char** );
+int	poisson_request( poisson_ctx*, char**, FILE* );
 
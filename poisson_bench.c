@@ -0,0 +1,223 @@
+// poisson_bench: timings of the generator's hot paths, built and run by
+// ./cmpbench. Every case runs in a child process of its own so that its peak
+// memory is its own, and prints one JSON line:
+//
+//   {"case":"gap_1d","size":"256","points":128,"reps":2000,"seconds":0.21,
+//    "gaps_per_s":1.2e6,"tries":0,"rss_kb":1380}
+//
+// gaps are the gaps that end on a sampled point (draws for the poisson case).
+// The main_* cases report whole schedules instead, each a weight search, as
+// "schedules_per_s" in place of "gaps_per_s"; tries is the schedules drawn by
+// one search. The sizes and sparsities are
+// those of the README Quick Reference: 2D experiments (1 NUS dimension) at 25
+// and 50%, 3D (2) at 10% and 4D (3) at 1 and 2%.
+//
+//   poisson_bench [name]		(only the cases whose name starts with name)
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "poisson_SAR.h"
+
+#define	BENCH_SECONDS	0.25		//  each case repeats for about this long  //
+#define	BENCH_SEED	5
+
+typedef	struct {
+	const	char	*name;
+	int	ndim;
+	int3	z;
+	int	tn;			//  points (the lamda*1000 for the poisson case)  //
+} bench_case;
+
+static	const	bench_case	cases[] = {
+	{ "poisson",	0,	{ 0, 0, 0 },		500 },
+	{ "poisson",	0,	{ 0, 0, 0 },		2000 },
+	{ "poisson",	0,	{ 0, 0, 0 },		5000 },
+	{ "poisson",	0,	{ 0, 0, 0 },		20000 },
+	{ "poisson",	0,	{ 0, 0, 0 },		50000 },
+	{ "gap_1d",	1,	{ 256, 1, 1 },		64 },
+	{ "gap_1d",	1,	{ 256, 1, 1 },		128 },
+	{ "gap_2d",	2,	{ 64, 128, 0 },		818 },
+	{ "gap_2d",	2,	{ 128, 128, 0 },	1638 },
+	{ "gap_3d",	3,	{ 32, 32, 32 },		328 },
+	{ "gap_3d",	3,	{ 64, 64, 48 },		3932 },
+	{ "main_1d",	1,	{ 256, 1, 1 },		64 },
+	{ "main_1d",	1,	{ 256, 1, 1 },		128 },
+	{ "main_2d",	2,	{ 64, 128, 0 },		818 },
+	{ "main_2d",	2,	{ 128, 128, 0 },	1638 },
+	{ "main_3d",	3,	{ 32, 32, 32 },		328 },
+	{ "main_3d",	3,	{ 64, 64, 48 },		3932 },
+	{ NULL,		0,	{ 0, 0, 0 },		0 }
+};
+
+static	double	bench_now( void )
+{
+	struct	timeval	tv;
+
+	gettimeofday( &tv, NULL );
+
+	return( tv.tv_sec + 1e-6*tv.tv_usec );
+}
+
+//  the converged weight of a case, so that the builders are timed at the density of the schedule  //
+
+static	float	bench_weight( const bench_case *c )
+{
+	poisson_ctx	ctx;
+	float	w = c->ndim == 3 ? 1.0 : 2.0;
+	int	*pts;
+
+	poisson_ctx_init( &ctx );
+	poisson_seed( &ctx, BENCH_SEED );
+	poisson_points( &ctx, c->ndim, (int*) c->z, c->tn, 0.01, 2.0, &w, &pts );
+	free( pts );
+	poisson_ctx_free( &ctx );
+
+	return( w );
+}
+
+static	void	bench_run( const bench_case *c, FILE *fp )
+{
+	poisson_ctx	ctx;
+	int3	i_0 = { 0, 0, 0 };
+	int3	z;
+	double	t0, t;
+	double	gaps = 0;
+	long	reps = 0;
+	int	tries = 0;
+	int	points = 0;
+	char	size[64];
+	float	ld = 1;
+	float	w = 0;
+	int	*v = NULL;
+	int	**v2d = NULL;
+	int	***v3d = NULL;
+	int	i, j;
+
+	memcpy( z, c->z, sizeof( int3 ) );
+	poisson_ctx_init( &ctx );
+	poisson_seed( &ctx, BENCH_SEED );
+
+	switch ( c->ndim ) {
+		case 0 : snprintf( size, sizeof( size ), "lambda %g", c->tn/1000.0 ); break;
+		case 1 : snprintf( size, sizeof( size ), "%d", z[0] ); ld = (float) z[0]/c->tn; break;
+		case 2 : snprintf( size, sizeof( size ), "%dx%d", z[0], z[1] ); ld = (float) z[0]*z[1]/c->tn; break;
+		default: snprintf( size, sizeof( size ), "%dx%dx%d", z[0], z[1], z[2] ); ld = (float) z[0]*z[1]*z[2]/c->tn; break;
+	}
+	if ( c->ndim && strncmp( c->name, "gap", 3 ) == 0 ) {
+		w = bench_weight( c );
+		poisson_scratch( &ctx, c->ndim, z );
+
+		//  the builders fill the same arrays from one rep to the next, as in a weight search  //
+		switch ( c->ndim ) {
+			case 1 : v = ( int* ) malloc( z[0]*sizeof( int ) ); break;
+			case 2 : v2d = ( int** ) malloc( z[0]*sizeof( int* ) );
+				for ( i = 0 ; i < z[0] ; i++ ) v2d[i] = ( int* ) malloc( z[1]*sizeof( int ) );
+				break;
+			case 3 : v3d = ( int*** ) malloc( z[0]*sizeof( int** ) );
+				for ( i = 0 ; i < z[0] ; i++ ) {
+					v3d[i] = ( int** ) malloc( z[1]*sizeof( int* ) );
+					for ( j = 0 ; j < z[1] ; j++ ) v3d[i][j] = ( int* ) malloc( z[2]*sizeof( int ) );
+				}
+				break;
+		}
+	}
+
+	t0 = bench_now();
+
+	do {
+		if ( c->ndim == 0 ) {
+			for ( i = 0 ; i < 100000 ; i++ ) poisson( &ctx, c->tn/1000.0 );
+			gaps += 100000;
+		}
+		else if ( v ) gaps += points = poisson_gap( &ctx, 0, i_0, z, v, ld, w, 2.0 );
+		else if ( v2d ) gaps += points = poisson_01_gap( &ctx, i_0, z, v2d, ld, w, 2.0 );
+		else if ( v3d ) gaps += points = poisson_012_gap( &ctx, i_0, z, v3d, ld, w, 2.0 );
+		else {		//  main_Nd: a seeded schedule with its weight search, printed to /dev/null  //
+			char	a[9][32];
+			char	*argv[10];
+			FILE	*out = fopen( "/dev/null", "w" );
+
+			snprintf( a[0], 32, "%d", c->ndim );
+			snprintf( a[1], 32, "%d", BENCH_SEED + (int) reps );
+			snprintf( a[2], 32, "2" );
+			snprintf( a[3], 32, "%d", c->tn );
+			snprintf( a[4], 32, "0.01" );
+			for ( i = 0 ; i < 3 ; i++ ) snprintf( a[5+i], 32, "%d", i < c->ndim ? z[i] : 0 );
+			snprintf( a[8], 32, "0" );
+			argv[0] = "poissonv3";
+			for ( i = 0 ; i < 9 ; i++ ) argv[i+1] = a[i];
+
+			switch ( c->ndim ) {
+				case 1 : main_1d( &ctx, argv, out ); break;
+				case 2 : main_2d( &ctx, argv, out ); break;
+				case 3 : main_3d( &ctx, argv, out ); break;
+			}
+			fclose( out );
+			tries += ctx.tries;
+			points = c->tn;
+		}
+		reps++;
+		t = bench_now()-t0;
+	} while ( t < BENCH_SECONDS );
+
+	poisson_ctx_free( &ctx );	//  the arrays go with the process  //
+
+	fprintf( fp, "{\"case\":\"%s\",\"size\":\"%s\",\"points\":%d,\"reps\":%ld,\"seconds\":%.4f,",
+		c->name, size, c->ndim ? points : 0, reps, t );
+	if ( strncmp( c->name, "main", 4 ) == 0 ) fprintf( fp, "\"schedules_per_s\":%.4g", reps/t );
+	else fprintf( fp, "\"gaps_per_s\":%.4g", gaps/t );
+	fprintf( fp, ",\"tries\":%.2f", (double) tries/reps );
+}
+
+int	main( int argc, char** argv )
+{
+	struct	rusage	ru;
+	char	line[512];
+	int	fd[2];
+	int	status;
+	pid_t	pid;
+	int	i, n;
+
+	setenv( "POISSONV3_CACHE", "/dev/null/poisson_bench", 1 );	//  no weight table or cache  //
+
+	for ( i = 0 ; cases[i].name ; i++ ) {
+		if ( argc > 1 && strncmp( cases[i].name, argv[1], strlen( argv[1] ) ) ) continue;
+
+		if ( pipe( fd ) ) {
+			perror( "pipe" );
+			exit( -1 );
+		}
+		fflush( stdout );
+		pid = fork();
+		if ( pid < 0 ) {
+			perror( "fork" );
+			exit( -1 );
+		}
+		if ( pid == 0 ) {
+			FILE	*fp = fdopen( fd[1], "w" );
+			close( fd[0] );
+			bench_run( &cases[i], fp );
+			fclose( fp );
+			_exit( 0 );
+		}
+
+		close( fd[1] );
+		n = read( fd[0], line, sizeof( line )-1 );
+		close( fd[0] );
+		wait4( pid, &status, 0, &ru );
+		if ( n <= 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) ) {
+			fprintf( stderr, "case %s failed\n", cases[i].name );
+			continue;
+		}
+		line[n] = 0;
+		printf( "%s,\"rss_kb\":%ld}\n", line, ru.ru_maxrss );
+	}
+
+	exit( 0 );
+}
@@ -0,0 +1,488 @@
+// On-disk schedule cache for poissonv3.
+//
+// A seeded run is fully determined by its arguments, so the schedule it
+// prints can be stored once and replayed on every rerun of the same
+// experiment instead of repeating the weight search. Entries are named by
+// a 64 bit FNV-1a hash of the normalized arguments and the generator
+// version and live in $POISSONV3_CACHE (default $HOME/.poissonv3/cache).
+// Entries are written to a temporary file and renamed into place, so a
+// reader never sees a partial schedule. Seed 0 (clock seeded) never hits
+// the cache.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "poisson_SAR.h"
+#include "poisson_cache.h"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static	int	cache_dir( char *dir )
+{
+	char	*env = getenv( "POISSONV3_CACHE" );
+	char	*home;
+
+	if ( env && *env ) {
+		snprintf( dir, PATH_MAX, "%s", env );
+		mkdir( dir, 0777 );
+		return( 0 );
+	}
+
+	home = getenv( "HOME" );
+	if ( !home || !*home ) return( -1 );
+
+	snprintf( dir, PATH_MAX, "%s/.poissonv3", home );
+	mkdir( dir, 0777 );
+	snprintf( dir, PATH_MAX, "%s/.poissonv3/cache", home );
+	mkdir( dir, 0777 );
+
+	return( 0 );
+}
+
+static	int	cache_path( const char *key, char *path )
+{
+	char	dir[PATH_MAX];
+
+	if ( cache_dir( dir ) ) return( -1 );
+
+	if ( snprintf( path, PATH_MAX, "%s/%s.sched", dir, key ) >= PATH_MAX ) return( -1 );
+
+	return( 0 );
+}
+
+//  copy a whole file to fp through a read-only mapping: 0, -1 if nothing was
+//  written (unreadable, or cut short of its last newline), 1 if the copy broke off  //
+
+static	int	cache_copy( int fd, FILE *fp )
+{
+	struct	stat	st;
+	void	*map;
+	int	status = 0;
+
+	if ( fstat( fd, &st ) ) return( -1 );
+	if ( st.st_size == 0 ) return( 0 );
+
+	map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( map == MAP_FAILED ) return( -1 );
+
+	if ( ( (char*) map )[st.st_size-1] != '\n' ) status = -1;
+	else if ( fwrite( map, 1, st.st_size, fp ) != (size_t) st.st_size || fflush( fp ) ) status = 1;
+
+	munmap( map, st.st_size );
+
+	return( status );
+}
+
+int	cache_key( char **argv, char *key )
+{
+	char	buf[256];
+	unsigned long long	h = 14695981039346656037ULL;
+	int	ndim = atoi( argv[1] );
+	float	seed = atof( argv[2] );
+	float	sine_portion = atof( argv[3] );
+	int	p = atoi( argv[4] );
+	float	tol = atof( argv[5] );
+	int	z[3];
+	int	shuffled;
+	int	partial;
+	int	shape;
+	float	a[3];
+	int	i;
+
+	if ( seed == 0 ) return( -1 );		//  clock seeded: never the same schedule twice  //
+	if ( ndim < 1 || ndim > 3 ) return( -1 );
+
+	if ( tol == 0 ) tol = 0.000001;
+
+	if ( poisson_order_parse( argv[9], &shuffled, &partial ) ) return( -1 );
+
+	for ( i = 0 ; i < 3 ; i++ ) z[i] = i < ndim ? atoi( argv[6+i] ) : 0;
+
+	//  normalize to what the generator actually uses (srand48 takes a long)  //
+
+	snprintf( buf, sizeof( buf ), "v%d|%d|%ld|%a|%d|%a|%d|%d|%d|%d",
+		POISSON_GEN_VERSION, ndim, (long) seed, (double) sine_portion, p, (double) tol,
+		z[0], z[1], z[2], shuffled );
+
+	if ( poisson_shape_parse( argv[3], &shape, a ) ) return( -1 );
+	if ( shape != POISSON_SINE ) {
+		snprintf( buf+strlen( buf ), sizeof( buf )-strlen( buf ), "|shape%d:%a,%a,%a", shape, (double) a[0], (double) a[1], (double) a[2] );
+	}
+
+	if ( partial ) strncat( buf, "|pc", sizeof( buf )-strlen( buf )-1 );
+
+	//  nested levels; a schedule extending a file depends on the file  //
+
+	if ( strchr( argv[4], '@' ) ) return( -1 );
+	if ( strchr( argv[4], ',' ) ) snprintf( buf+strlen( buf ), sizeof( buf )-strlen( buf ), "|levels:%s", argv[4] );
+
+	//  3D schedules on plane streams are different schedules  //
+
+	if ( ndim == 3 && poisson_threads() > 0 ) strncat( buf, "|lanes", sizeof( buf )-strlen( buf )-1 );
+
+	for ( i = 0 ; buf[i] ; i++ ) {
+		h ^= (unsigned char) buf[i];
+		h *= 1099511628211ULL;
+	}
+
+	snprintf( key, 17, "%016llx", h );
+
+	return( 0 );
+}
+
+int	cache_serve( const char *key, FILE *fp )
+{
+	char	path[PATH_MAX];
+	struct	stat	st;
+	int	fd;
+	int	status = -1;
+
+	if ( cache_path( key, path ) ) return( 0 );
+
+	fd = open( path, O_RDONLY );
+	if ( fd < 0 ) return( 0 );
+
+	//  a damaged entry is a miss as long as nothing of it has been written  //
+
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) status = cache_copy( fd, fp );
+	close( fd );
+
+	return( status == 0 ? 1 : status < 0 ? 0 : -1 );
+}
+
+//  a file is replaced by writing a temporary file next to it and renaming
+//  that over it: readers see the old contents or the new, never a part, and
+//  concurrent writers each write a file of their own  //
+
+FILE*	replace_begin( const char *path, char *tmp )
+{
+	int	fd;
+	FILE	*fp;
+
+	if ( snprintf( tmp, PATH_MAX, "%s.XXXXXX", path ) >= PATH_MAX ) return( NULL );
+
+	fd = mkstemp( tmp );
+	if ( fd < 0 ) return( NULL );
+
+	fp = fdopen( fd, "w+" );
+	if ( !fp ) {
+		close( fd );
+		unlink( tmp );
+	}
+
+	return( fp );
+}
+
+int	replace_commit( FILE *fp, const char *tmp, const char *path, int keep )
+{
+	mode_t	mask = umask( 0 );
+
+	umask( mask );
+
+	//  the mode a plain fopen would have given, not the 0600 of mkstemp  //
+	if ( fflush( fp ) || ferror( fp ) || fchmod( fileno( fp ), 0666 & ~mask ) ) keep = 0;
+	if ( fclose( fp ) ) keep = 0;
+
+	if ( !keep || rename( tmp, path ) ) {
+		unlink( tmp );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+FILE*	cache_begin( const char *key, char *tmp )
+{
+	char	path[PATH_MAX];
+
+	if ( cache_path( key, path ) ) return( NULL );
+
+	return( replace_begin( path, tmp ) );
+}
+
+int	cache_commit( FILE *fp, const char *tmp, const char *key, FILE *out )
+{
+	char	path[PATH_MAX];
+	int	status;
+
+	status = fflush( fp ) || cache_copy( fileno( fp ), out ) ? -1 : 0;
+
+	if ( ferror( fp ) || status || cache_path( key, path ) || fchmod( fileno( fp ), 0644 ) ) {
+		fclose( fp );
+		unlink( tmp );
+		return( status );
+	}
+
+	fclose( fp );
+
+	if ( rename( tmp, path ) ) unlink( tmp );
+
+	return( 0 );
+}
+
+//  Weight warm start table.
+//
+//  Every search records the weight it converged on in <cache dir>/weights,
+//  one line per (ndim, grid, points, sine portion). A new search starts
+//  from the inverse-distance weighted mean (in log space) of the nearest
+//  recorded weights of the same dimension count and sine portion, the
+//  distance being measured between log grid sizes and log sparsities.  //
+
+#define	WSTART_MAX	512		//  oldest entries are dropped beyond this  //
+#define	WSTART_NEAR	4		//  number of neighbours interpolated  //
+
+typedef	struct {
+	int	ndim;
+	int	z[3];
+	int	tn;
+	float	sine_portion;
+	float	w;
+} wentry;
+
+//  the table is kept in memory and only read again when the file changes, so  //
+//  that a long running poissonv3 --serve shares it between its threads  //
+
+static	wentry	tab[WSTART_MAX];
+static	int	tab_n = 0;
+static	struct	stat	tab_st;
+static	pthread_mutex_t	tab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static	int	wstart_load( char *path )
+{
+	char	dir[PATH_MAX];
+	struct	stat	st;
+	FILE	*fp;
+	int	n = 0;
+
+	if ( cache_dir( dir ) ) return( -1 );
+
+	if ( snprintf( path, PATH_MAX, "%s/weights", dir ) >= PATH_MAX ) return( -1 );
+
+	if ( stat( path, &st ) ) {
+		tab_n = 0;
+		return( 0 );
+	}
+	if ( st.st_mtime == tab_st.st_mtime && st.st_ino == tab_st.st_ino && st.st_size == tab_st.st_size ) {
+		return( tab_n );
+	}
+
+	fp = fopen( path, "r" );
+	if ( !fp ) return( tab_n = 0 );
+
+	while ( n < WSTART_MAX && fscanf( fp, "%d %d %d %d %d %f %f", &tab[n].ndim,
+			&tab[n].z[0], &tab[n].z[1], &tab[n].z[2], &tab[n].tn,
+			&tab[n].sine_portion, &tab[n].w ) == 7 ) {
+		int	i;
+
+		if ( tab[n].ndim < 1 || tab[n].ndim > 3 || tab[n].w <= 0 || tab[n].tn <= 0 ) continue;
+		for ( i = 0 ; i < tab[n].ndim && tab[n].z[i] > 0 ; i++ );
+		if ( i == tab[n].ndim ) n++;
+	}
+
+	fclose( fp );
+
+	tab_st = st;
+
+	return( tab_n = n );
+}
+
+static	double	wstart_dist( wentry *e, int ndim, int *z, int tn )
+{
+	double	d = 0;
+	double	ld = 0;
+	double	ld_e = 0;
+	double	t;
+	int	i;
+
+	for ( i = 0 ; i < ndim ; i++ ) {
+		t = log( (double) z[i] ) - log( (double) e->z[i] );
+		d += t*t;
+		ld += log( (double) z[i] );
+		ld_e += log( (double) e->z[i] );
+	}
+
+	t = ( ld - log( (double) tn ) ) - ( ld_e - log( (double) e->tn ) );
+
+	return( d + t*t );
+}
+
+static	int	wstart_predict( int ndim, int *z, int tn, float sine_portion, float *w )
+{
+	char	path[PATH_MAX];
+	int	near[WSTART_NEAR];
+	double	dist[WSTART_NEAR];
+	double	sw = 0;
+	double	slw = 0;
+	int	nn = 0;
+	int	n, i, j;
+
+	if ( tn <= 0 ) return( 0 );
+	for ( i = 0 ; i < ndim ; i++ ) if ( z[i] <= 0 ) return( 0 );
+
+	n = wstart_load( path );
+
+	for ( i = 0 ; i < n ; i++ ) {
+
+		double	d;
+
+		if ( tab[i].ndim != ndim || tab[i].sine_portion != sine_portion ) continue;
+
+		d = wstart_dist( &tab[i], ndim, z, tn );
+
+		//  insertion into the short sorted list of nearest entries  //
+
+		if ( nn < WSTART_NEAR ) j = nn++;
+		else if ( d < dist[WSTART_NEAR-1] ) j = WSTART_NEAR-1;
+		else continue;
+
+		for ( ; j > 0 && dist[j-1] > d ; j-- ) {
+			dist[j] = dist[j-1];
+			near[j] = near[j-1];
+		}
+		dist[j] = d;
+		near[j] = i;
+	}
+
+	if ( nn == 0 ) return( 0 );
+
+	if ( dist[0] == 0 ) {
+		*w = tab[near[0]].w;
+		return( 1 );
+	}
+
+	for ( i = 0 ; i < nn ; i++ ) {
+		sw += 1.0/dist[i];
+		slw += log( tab[near[i]].w )/dist[i];
+	}
+
+	*w = exp( slw/sw );
+
+	return( 1 );
+}
+
+static	void	wstart_store( int ndim, int *z, int tn, float sine_portion, float w )
+{
+	char	path[PATH_MAX];
+	char	tmp[PATH_MAX];
+	int	fd;
+	FILE	*fp;
+	int	n, i;
+
+	n = wstart_load( path );
+	if ( n < 0 ) return;
+
+	//  the new entry replaces the one recorded for the same run, or the oldest if the table is full  //
+
+	for ( i = 0 ; i < n ; i++ ) {
+		if ( tab[i].ndim == ndim && tab[i].tn == tn && tab[i].sine_portion == sine_portion &&
+		     wstart_dist( &tab[i], ndim, z, tn ) == 0 ) break;
+	}
+	if ( i == n && n == WSTART_MAX ) i = 0;
+	if ( i < n ) {
+		memmove( &tab[i], &tab[i+1], (n-i-1)*sizeof( wentry ) );
+		n--;
+	}
+
+	tab[n].ndim = ndim;
+	for ( i = 0 ; i < 3 ; i++ ) tab[n].z[i] = i < ndim ? z[i] : 0;
+	tab[n].tn = tn;
+	tab[n].sine_portion = sine_portion;
+	tab[n].w = w;
+	n++;
+
+	tab_n = n;
+	memset( &tab_st, 0, sizeof( tab_st ) );	//  reread unless the file is written below  //
+
+	if ( snprintf( tmp, PATH_MAX, "%s.XXXXXX", path ) >= PATH_MAX ) return;
+
+	fd = mkstemp( tmp );
+	if ( fd < 0 ) return;
+
+	fp = fdopen( fd, "w" );
+	if ( !fp ) {
+		close( fd );
+		unlink( tmp );
+		return;
+	}
+
+	for ( i = 0 ; i < n ; i++ ) {
+		fprintf( fp, "%d %d %d %d %d %.9g %.9g\n", tab[i].ndim, tab[i].z[0], tab[i].z[1],
+			tab[i].z[2], tab[i].tn, tab[i].sine_portion, tab[i].w );
+	}
+
+	if ( fclose( fp ) || chmod( tmp, 0644 ) || rename( tmp, path ) ) unlink( tmp );
+	else stat( path, &tab_st );
+}
+
+int	wstart_lookup( int ndim, int *z, int tn, float sine_portion, float *w )
+{
+	int	found;
+
+	pthread_mutex_lock( &tab_lock );
+	found = wstart_predict( ndim, z, tn, sine_portion, w );
+	pthread_mutex_unlock( &tab_lock );
+
+	return( found );
+}
+
+void	wstart_record( int ndim, int *z, int tn, float sine_portion, float w )
+{
+	pthread_mutex_lock( &tab_lock );
+	wstart_store( ndim, z, tn, sine_portion, w );
+	pthread_mutex_unlock( &tab_lock );
+}
+
+#else
+
+//  no mmap on Windows: always miss and generate the schedule directly  //
+
+int	cache_key( char **argv, char *key ) { return( -1 ); }
+
+int	cache_serve( const char *key, FILE *fp ) { return( 0 ); }
+
+FILE*	replace_begin( const char *path, char *tmp )
+{
+	if ( snprintf( tmp, PATH_MAX, "%s.tmp", path ) >= PATH_MAX ) return( NULL );
+
+	return( fopen( tmp, "w" ) );
+}
+
+int	replace_commit( FILE *fp, const char *tmp, const char *path, int keep )
+{
+	int	status = fclose( fp );
+
+	//  rename does not replace an existing file here: remove it first  //
+
+	if ( status == 0 && keep && rename( tmp, path ) ) {
+		remove( path );
+		status = rename( tmp, path );
+	}
+	if ( status || !keep ) {
+		remove( tmp );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+FILE*	cache_begin( const char *key, char *tmp ) { return( NULL ); }
+
+int	cache_commit( FILE *fp, const char *tmp, const char *key, FILE *out ) { return( -1 ); }
+
+int	wstart_lookup( int ndim, int *z, int tn, float sine_portion, float *w ) { return( 0 ); }
+
+void	wstart_record( int ndim, int *z, int tn, float sine_portion, float w ) { }
+
+#endif
@@ -0,0 +1,49 @@
+// Header file for poisson_cache.c //
+
+// Bump whenever the schedule produced for a given set of arguments changes,
+// so that stale cache entries are never served.
+// 2: seeded output shuffle, :pc component draws after the points
+
+#define	POISSON_GEN_VERSION	2
+
+// input: argv (the 9 positional arguments of poissonv3), key (17 chars, *updated*)
+// return: 0 if the run is reproducible and may be cached, -1 otherwise (seed 0)
+
+int	cache_key( char**, char* );
+
+// input: key, fp (stream the cached schedule is written to)
+// return: 1 if the schedule was served from the cache, 0 on a miss (nothing written),
+// -1 if the copy failed after part of the schedule was written
+
+int	cache_serve( const char*, FILE* );
+
+// input: key, tmp (path of the temporary entry, *updated*)
+// return: stream to write the schedule to, NULL if the cache is unavailable
+
+FILE*	cache_begin( const char*, char* );
+
+// input: fp (stream from cache_begin), tmp, key, out (stream the schedule is copied to)
+// return: 0 on success, -1 if the schedule could not be copied to out
+
+int	cache_commit( FILE*, const char*, const char*, FILE* );
+
+// input: path (file to replace), tmp (path of the temporary file, *updated*)
+// return: stream to write the new contents to, NULL if no temporary file can be made
+
+FILE*	replace_begin( const char*, char* );
+
+// input: fp (stream from replace_begin), tmp, path, keep (0 to drop the new contents)
+// return: 0 once path holds the new contents, -1 if it was left as it was
+
+int	replace_commit( FILE*, const char*, const char*, int );
+
+// input: ndim (number of NUS dimensions), z (grid size), tn (number of sampled points),
+// sine_portion, w (weight, *updated* with the prediction if one is available)
+// return: 1 if the warm start table predicted a weight, 0 otherwise
+
+int	wstart_lookup( int, int*, int, float, float* );
+
+// input: ndim, z, tn, sine_portion, w (the weight the search converged on)
+// return: nothing
+
+void	wstart_record( int, int*, int, float, float );
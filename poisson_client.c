@@ -0,0 +1,156 @@
+// Client side of poissonv3 --serve.
+//
+// A request is the 9 positional arguments on one line, followed by a hash
+// of the caller's settings (serve_env); a server with other settings
+// refuses it and the caller generates the schedule itself. The reply is a
+// status line ("0" on success) followed by the schedule. poissonv3 itself
+// tries a running server before generating anything, so the macros gain
+// from it without changes. Built with -DPOISSON_CLIENT this file is also
+// poissonc, a minimal client taking the same arguments that falls back to
+// running poissonv3 from its own directory when no server is listening.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "poisson_serve.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int	serve_path( const char *path, char *sock )
+{
+	char	*env = getenv( "POISSONV3_SOCKET" );
+	char	*home = getenv( "HOME" );
+
+	if ( path && *path ) snprintf( sock, PATH_MAX, "%s", path );
+	else if ( env && *env ) snprintf( sock, PATH_MAX, "%s", env );
+	else if ( home && *home ) snprintf( sock, PATH_MAX, "%s/.poissonv3/serve.sock", home );
+	else return( -1 );
+
+	return( 0 );
+}
+
+//  the variables that change a schedule or where it is cached  //
+
+static	const	char	*serve_vars[] = { "POISSONV3_THREADS", "POISSONV3_SPARSE", "POISSONV3_SIMD", "POISSONV3_CACHE", "HOME", NULL };
+
+unsigned long	serve_env( void )
+{
+	unsigned long	h = 2166136261UL;
+	const	char	*env;
+	int	i;
+
+	for ( i = 0 ; serve_vars[i] ; i++ ) {
+		env = getenv( serve_vars[i] );
+		for ( ; env && *env ; env++ ) h = ( ( h ^ (unsigned char) *env )*16777619UL ) & 0xffffffffUL;
+		h = ( ( h ^ 0xff )*16777619UL ) & 0xffffffffUL;	//  unset and empty differ from the next value  //
+		if ( !env ) h = ( ( h ^ 0xfe )*16777619UL ) & 0xffffffffUL;
+	}
+
+	return( h );
+}
+
+int	serve_request( char **argv, FILE *fp )
+{
+	struct	sockaddr_un	addr;
+	char	sock[PATH_MAX];
+	char	buf[65536];
+	int	fd;
+	int	i, len;
+	int	n = 0;
+	int	status = -1;
+
+	//  a schedule extending a file reads it relative to the caller  //
+
+	if ( strchr( argv[4], '@' ) ) return( -1 );
+
+	if ( serve_path( NULL, sock ) || strlen( sock ) >= sizeof( addr.sun_path ) ) return( -1 );
+	if ( access( sock, F_OK ) ) return( -1 );
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, sock );
+
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 ) return( -1 );
+
+	if ( connect( fd, (struct sockaddr*) &addr, sizeof( addr ) ) ) {
+		close( fd );
+		return( -1 );
+	}
+
+	for ( i = 1, len = 0 ; i < 10 ; i++ ) {
+		len += snprintf( buf+len, sizeof( buf )-len, "%s ", argv[i] );
+	}
+	len += snprintf( buf+len, sizeof( buf )-len, "env:%08lx\n", serve_env() );
+	if ( len >= (int) sizeof( buf ) || write( fd, buf, len ) != len ) {
+		close( fd );
+		return( -1 );
+	}
+
+	//  status line, then the schedule  //
+
+	for ( len = 0 ; len < 16 ; len++ ) {
+		if ( read( fd, buf+len, 1 ) != 1 ) break;
+		if ( buf[len] == '\n' ) break;
+	}
+	if ( len < 16 && buf[len] == '\n' && len > 0 ) {
+		buf[len] = 0;
+		status = atoi( buf ) == 0 ? 0 : -1;
+	}
+
+	//  once the schedule is being copied a failure can no longer be retried locally  //
+
+	while ( status == 0 && ( n = read( fd, buf, sizeof( buf ) ) ) > 0 ) {
+		if ( fwrite( buf, 1, n, fp ) != (size_t) n ) status = 1;
+	}
+	if ( n < 0 ) status = 1;
+
+	close( fd );
+
+	return( status );
+}
+
+#ifdef POISSON_CLIENT
+
+int	main( int argc, char** argv )
+{
+	char	path[PATH_MAX];
+	char	*slash;
+	int	status = argc == 10 ? serve_request( argv, stdout ) : -1;
+
+	if ( status >= 0 ) exit( status ? -1 : 0 );
+
+	//  no server: run the generator itself with the same arguments  //
+
+	snprintf( path, PATH_MAX, "%s", argv[0] );
+	slash = strrchr( path, '/' );
+	if ( slash ) snprintf( slash+1, PATH_MAX-( slash+1-path ), "poissonv3" );
+	else snprintf( path, PATH_MAX, "poissonv3" );
+
+	argv[0] = path;
+	execvp( path, argv );
+
+	fprintf( stderr, "cannot run %s\n", path );
+	exit( -1 );
+}
+
+#endif
+
+#else
+
+//  no unix sockets on Windows: always generate locally  //
+
+int	serve_path( const char *path, char *sock ) { return( -1 ); }
+
+int	serve_request( char **argv, FILE *fp ) { return( -1 ); }
+
+#endif
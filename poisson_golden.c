@@ -0,0 +1,418 @@
+// poisson_golden: conformance of the generator against recorded schedules,
+// built and run by ./cmpgolden.
+//
+//   poisson_golden check manifest	every schedule of the manifest bit for bit
+//   poisson_golden record manifest	rewrite the manifest from this generator
+//   poisson_golden fast manifest [file]	gap statistics of the fast mode
+//
+// A manifest line is a hash, the number of lines and the 9 arguments of
+// poissonv3; the hash is FNV-1a 64 of the schedule text, as the schedule
+// cache keys are. check runs every line in compatibility mode (one random
+// stream, cache off); 3D lines are run on the sparse path as well, which must
+// give the same schedule. record is for deliberate changes of the schedules
+// only: published schedules must keep their seeds.
+//
+// fast compares, for every plain 3D line (a sine portion, one number of
+// points, in grid order), the schedules of seeds 1..GOLDEN_SEEDS on plane
+// streams (POISSONV3_THREADS, 2 if unset) with those of the single stream:
+// the gaps along each dimension must pass a two sample Kolmogorov-Smirnov
+// test and the mean number of points must agree.
+// A 2D schedule file (the sample file of the repository, made from the clock
+// and so with no seed to reproduce it) is checked the same way against
+// compatibility schedules of its number of points and grid, sine portion 2.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "poisson_SAR.h"
+
+#define	GOLDEN_SEEDS	24		//  schedules per mode in the statistical checks  //
+#define	GOLDEN_KS	1.95		//  Kolmogorov-Smirnov critical value, alpha = 0.001  //
+#define	GOLDEN_LINE	1024
+
+typedef	struct {
+	int	*g;			//  gap lengths  //
+	int	n;
+	int	max;
+} gaps;
+
+//  run one request in this process; the schedule text in *out  //
+
+static	int	golden_run( char **args, char **out, size_t *len )
+{
+	poisson_ctx	ctx;
+	char	*argv[10];
+	FILE	*fp;
+	int	status, i;
+
+	argv[0] = "poissonv3";
+	for ( i = 0 ; i < 9 ; i++ ) argv[i+1] = args[i];
+
+	*out = NULL;
+	fp = open_memstream( out, len );
+	if ( !fp ) return( -1 );
+
+	poisson_ctx_init( &ctx );
+	status = poisson_request( &ctx, argv, fp );
+	poisson_ctx_free( &ctx );
+	fclose( fp );
+
+	return( status );
+}
+
+static	unsigned long long	golden_hash( const char *s, size_t len )
+{
+	unsigned long long	h = 14695981039346656037ULL;
+	size_t	i;
+
+	for ( i = 0 ; i < len ; i++ ) {
+		h ^= (unsigned char) s[i];
+		h *= 1099511628211ULL;
+	}
+
+	return( h );
+}
+
+static	int	golden_lines( const char *s, size_t len )
+{
+	int	n = 0;
+	size_t	i;
+
+	for ( i = 0 ; i < len ; i++ ) n += s[i] == '\n';
+
+	return( n );
+}
+
+//  a manifest line: hash, lines and 9 arguments (*updated*, pointing into line); 0 if it is not one  //
+
+static	int	golden_parse( char *line, unsigned long long *h, int *lines, char **args )
+{
+	char	*tok, *save;
+	int	n = 0;
+
+	tok = strtok_r( line, " \t\n", &save );
+	if ( !tok || *tok == '#' ) return( 0 );
+	*h = strtoull( tok, NULL, 16 );
+	tok = strtok_r( NULL, " \t\n", &save );
+	if ( !tok ) return( 0 );
+	*lines = atoi( tok );
+	while ( n < 9 && ( tok = strtok_r( NULL, " \t\n", &save ) ) ) args[n++] = tok;
+
+	return( n == 9 );
+}
+
+static	int	golden_check( const char *manifest, int record )
+{
+	FILE	*fm = fopen( manifest, "r" );
+	char	line[GOLDEN_LINE], copy[GOLDEN_LINE];
+	char	*args[9];
+	char	*out;
+	size_t	len;
+	unsigned long long	h, g;
+	int	lines, n, i;
+	int	fail = 0, total = 0;
+
+	if ( !fm ) {
+		fprintf( stderr, "Cannot read %s\n", manifest );
+		return( -1 );
+	}
+
+	while ( fgets( line, sizeof( line ), fm ) ) {
+		strcpy( copy, line );
+		if ( !golden_parse( copy, &h, &lines, args ) ) {
+			if ( record ) fputs( line, stdout );	//  comments stay  //
+			continue;
+		}
+
+		unsetenv( "POISSONV3_SPARSE" );
+		if ( golden_run( args, &out, &len ) ) {
+			fprintf( stderr, "FAIL (no schedule):" );
+			for ( i = 0 ; i < 9 ; i++ ) fprintf( stderr, " %s", args[i] );
+			fprintf( stderr, "\n" );
+			free( out );
+			fail++;
+			continue;
+		}
+		g = golden_hash( out, len );
+		n = golden_lines( out, len );
+		free( out );
+
+		if ( record ) {
+			printf( "%016llx %6d", g, n );
+			for ( i = 0 ; i < 9 ; i++ ) printf( " %s", args[i] );
+			printf( "\n" );
+			continue;
+		}
+
+		total++;
+		if ( g != h || n != lines ) {
+			fprintf( stderr, "FAIL:" );
+			for ( i = 0 ; i < 9 ; i++ ) fprintf( stderr, " %s", args[i] );
+			fprintf( stderr, " (%d lines, %d recorded)\n", n, lines );
+			fail++;
+			continue;
+		}
+
+		//  the sparse path must give the same 3D schedule  //
+
+		if ( atoi( args[0] ) == 3 ) {
+			setenv( "POISSONV3_SPARSE", "0", 1 );
+			if ( golden_run( args, &out, &len ) || golden_hash( out, len ) != h ) {
+				fprintf( stderr, "FAIL (sparse path):" );
+				for ( i = 0 ; i < 9 ; i++ ) fprintf( stderr, " %s", args[i] );
+				fprintf( stderr, "\n" );
+				fail++;
+			}
+			free( out );
+			unsetenv( "POISSONV3_SPARSE" );
+		}
+	}
+
+	fclose( fm );
+
+	if ( !record ) printf( "check: %d of %d schedules as recorded\n", total-fail, total );
+
+	return( fail ? -1 : 0 );
+}
+
+static	void	gaps_add( gaps *a, int g )
+{
+	if ( a->n == a->max ) {
+		a->max = a->max ? 2*a->max : 4096;
+		a->g = ( int* ) realloc( a->g, a->max*sizeof( int ) );
+	}
+	a->g[a->n++] = g;
+}
+
+//  gaps between neighbours along every dimension of the points of a schedule text  //
+
+static	int	golden_gaps( const char *s, int ndim, int3 z, gaps *a )
+{
+	unsigned char	*m;
+	size_t	cells = (size_t) z[0]*( ndim > 1 ? z[1] : 1 )*( ndim > 2 ? z[2] : 1 );
+	size_t	stride[3];
+	int3	k;
+	int	d, e, f, x, last;
+	int	n = 0;
+
+	stride[0] = 1;
+	stride[1] = z[0];
+	stride[2] = (size_t) z[0]*( ndim > 1 ? z[1] : 1 );
+
+	m = ( unsigned char* ) calloc( cells, 1 );
+	while ( *s ) {
+		char	*end;
+		size_t	c = 0;
+		for ( d = 0 ; d < ndim ; d++ ) {
+			x = strtol( s, &end, 10 );
+			if ( x >= 0 && x < z[d] ) c += x*stride[d];
+			s = end;
+		}
+		m[c] = 1;
+		n++;
+		while ( *s && *s != '\n' ) s++;
+		if ( *s ) s++;
+	}
+
+	for ( d = 0 ; d < ndim ; d++ ) {
+		e = ( d+1 )%ndim;
+		f = ( d+2 )%ndim;
+		for ( k[e] = 0 ; k[e] < ( ndim > 1 ? z[e] : 1 ) ; k[e]++ ) {
+			for ( k[f] = 0 ; k[f] < ( ndim > 2 ? z[f] : 1 ) ; k[f]++ ) {
+				size_t	base = ( ndim > 1 ? k[e]*stride[e] : 0 ) + ( ndim > 2 ? k[f]*stride[f] : 0 );
+				for ( last = -1, x = 0 ; x < z[d] ; x++ ) {
+					if ( !m[base+x*stride[d]] ) continue;
+					if ( last >= 0 ) gaps_add( &a[d], x-last-1 );
+					last = x;
+				}
+			}
+		}
+	}
+
+	free( m );
+
+	return( n );
+}
+
+static	int	golden_order( const void *a, const void *b )
+{
+	return( *(const int*) a - *(const int*) b );
+}
+
+//  two sample Kolmogorov-Smirnov statistic, scaled so that GOLDEN_KS is the critical value  //
+
+static	double	golden_ks( gaps *a, gaps *b )
+{
+	double	d = 0;
+	int	i = 0, j = 0;
+	int	x;
+
+	if ( a->n == 0 || b->n == 0 ) return( a->n == b->n ? 0 : 1e9 );
+
+	qsort( a->g, a->n, sizeof( int ), golden_order );
+	qsort( b->g, b->n, sizeof( int ), golden_order );
+
+	while ( i < a->n && j < b->n ) {
+		x = a->g[i] < b->g[j] ? a->g[i] : b->g[j];
+		while ( i < a->n && a->g[i] == x ) i++;
+		while ( j < b->n && b->g[j] == x ) j++;
+		if ( fabs( (double) i/a->n - (double) j/b->n ) > d ) d = fabs( (double) i/a->n - (double) j/b->n );
+	}
+
+	return( d*sqrt( (double) a->n*b->n/( a->n+b->n ) ) );
+}
+
+//  schedules of seeds 1..GOLDEN_SEEDS, on plane streams or not  //
+
+static	double	golden_sample( char **args, int streams, const char *threads, int ndim, int3 z, gaps *a )
+{
+	char	*run[9];
+	char	seed[16];
+	char	*out;
+	size_t	len;
+	double	n = 0;
+	int	s, i;
+
+	if ( streams ) setenv( "POISSONV3_THREADS", threads, 1 );
+	else unsetenv( "POISSONV3_THREADS" );
+
+	for ( i = 0 ; i < 9 ; i++ ) run[i] = args[i];
+	run[1] = seed;
+
+	for ( s = 1 ; s <= GOLDEN_SEEDS ; s++ ) {
+		snprintf( seed, sizeof( seed ), "%d", s );
+		if ( golden_run( run, &out, &len ) == 0 ) n += golden_gaps( out, ndim, z, a );
+		free( out );
+	}
+
+	unsetenv( "POISSONV3_THREADS" );
+
+	return( n/GOLDEN_SEEDS );
+}
+
+static	int	golden_compare( const char *name, gaps *a, gaps *b, int ndim, double na, double nb, double tol )
+{
+	int	d, fail = 0;
+	double	ks;
+
+	for ( d = 0 ; d < ndim ; d++ ) {
+		ks = golden_ks( &a[d], &b[d] );
+		if ( ks > GOLDEN_KS ) fail = 1;
+		printf( "%s: dimension %d gaps KS %.2f%s\n", name, d+1, ks, ks > GOLDEN_KS ? " FAIL" : "" );
+	}
+	if ( fabs( na-nb ) > tol*nb+1 ) {
+		printf( "%s: %.1f points against %.1f FAIL\n", name, na, nb );
+		fail = 1;
+	}
+
+	return( fail );
+}
+
+static	int	golden_fast( const char *manifest, const char *file )
+{
+	FILE	*fm = fopen( manifest, "r" );
+	char	line[GOLDEN_LINE];
+	char	name[GOLDEN_LINE];
+	char	*args[9];
+	const	char	*threads = getenv( "POISSONV3_THREADS" );
+	unsigned long long	h;
+	gaps	a[3], b[3];
+	int3	z;
+	double	na, nb;
+	int	lines, d, i;
+	int	fail = 0;
+
+	if ( !threads || atoi( threads ) < 1 ) threads = "2";
+
+	if ( !fm ) {
+		fprintf( stderr, "Cannot read %s\n", manifest );
+		return( -1 );
+	}
+
+	while ( fgets( line, sizeof( line ), fm ) ) {
+		if ( !golden_parse( line, &h, &lines, args ) ) continue;
+		if ( atoi( args[0] ) != 3 || strchr( args[2], ':' ) || strchr( args[3], ',' ) || strcmp( args[8], "0" ) ) continue;
+
+		for ( i = 0 ; i < 3 ; i++ ) z[i] = atoi( args[5+i] );
+		snprintf( name, sizeof( name ), "3 %s %s %s %s %s %s", args[2], args[3], args[4], args[5], args[6], args[7] );
+
+		memset( a, 0, sizeof( a ) );
+		memset( b, 0, sizeof( b ) );
+		na = golden_sample( args, 1, threads, 3, z, a );
+		nb = golden_sample( args, 0, threads, 3, z, b );
+		fail |= golden_compare( name, a, b, 3, na, nb, atof( args[4] )+0.02 );
+		for ( d = 0 ; d < 3 ; d++ ) { free( a[d].g ); free( b[d].g ); }
+	}
+
+	fclose( fm );
+
+	//  a recorded schedule file against compatibility schedules of its size (2D, sine portion 2)  //
+
+	if ( file ) {
+		FILE	*ff = fopen( file, "r" );
+		char	*text;
+		char	count[16], x[16], y[16];
+		char	*run[9] = { "2", "1", "2", count, "0.001", x, y, "0", "0" };
+		long	size;
+
+		if ( !ff ) {
+			fprintf( stderr, "Cannot read %s\n", file );
+			return( -1 );
+		}
+		fseek( ff, 0, SEEK_END );
+		size = ftell( ff );
+		rewind( ff );
+		text = ( char* ) calloc( size+1, 1 );
+		if ( fread( text, 1, size, ff ) != (size_t) size ) size = 0;
+		fclose( ff );
+
+		//  the grid: the smallest powers of two holding the points  //
+
+		z[0] = z[1] = 1;
+		z[2] = 0;
+		for ( i = 0 ; text[i] ; ) {
+			char	*end;
+			for ( d = 0 ; d < 2 ; d++ ) {
+				int	v = strtol( text+i, &end, 10 );
+				while ( z[d] <= v ) z[d] *= 2;
+				i = end-text;
+			}
+			while ( text[i] && text[i] != '\n' ) i++;
+			if ( text[i] ) i++;
+		}
+
+		memset( a, 0, sizeof( a ) );
+		memset( b, 0, sizeof( b ) );
+		na = golden_gaps( text, 2, z, a );
+		snprintf( count, sizeof( count ), "%d", (int) na );
+		snprintf( x, sizeof( x ), "%d", z[0] );
+		snprintf( y, sizeof( y ), "%d", z[1] );
+		nb = golden_sample( run, 0, threads, 2, z, b );
+		snprintf( name, sizeof( name ), "%s (2 2 %s 0.001 %s %s)", file, count, x, y );
+		fail |= golden_compare( name, a, b, 2, na, nb, 0.01 );
+		for ( d = 0 ; d < 2 ; d++ ) { free( a[d].g ); free( b[d].g ); }
+		free( text );
+	}
+
+	printf( "fast: %s\n", fail ? "gap statistics differ" : "gap statistics equivalent" );
+
+	return( fail ? -1 : 0 );
+}
+
+int	main( int argc, char** argv )
+{
+	if ( argc < 3 || ( strcmp( argv[1], "check" ) && strcmp( argv[1], "record" ) && strcmp( argv[1], "fast" ) ) ) {
+		fprintf( stderr, "usage: poisson_golden check|record manifest\n" );
+		fprintf( stderr, "       poisson_golden fast manifest [schedule file]\n" );
+		exit( -1 );
+	}
+
+	setenv( "POISSONV3_CACHE", "/dev/null/poisson_golden", 1 );	//  never replay: generate  //
+
+	if ( strcmp( argv[1], "fast" ) == 0 ) exit( golden_fast( argv[2], argc > 3 ? argv[3] : NULL ) ? -1 : 0 );
+
+	unsetenv( "POISSONV3_THREADS" );	//  compatibility mode: the single random stream  //
+
+	exit( golden_check( argv[2], strcmp( argv[1], "record" ) == 0 ) ? -1 : 0 );
+}
@@ -0,0 +1,185 @@
+// Python bindings of the poissonv3 generator (module poisson, built by
+// ./cmppoiss when numpy is installed):
+//
+//   import poisson
+//   pts = poisson.points( 2, 5, 2, 818, 0.001, 64, 128 )	# n x 2 int32 coordinates
+//   m = poisson.mask( 2, 5, 2, 818, 0.001, 64, 128 )	# 64 x 128 uint8, 1 where sampled
+//
+// The arguments are those of poissonv3 (ndim, seed, sine portion or density,
+// number of points, tolerance, sizes), so a seeded call gives the points of
+// the same poissonv3 run, in grid order. The arrays are returned over the
+// buffers the generator filled, without a copy, and the GIL is released while
+// the schedule is generated: threads may generate schedules concurrently.
+// The schedule cache and the weight table are not used.
+
+#define	PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define	NPY_NO_DEPRECATED_API	NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include <stdlib.h>
+#include <string.h>
+#include "poisson_SAR.h"
+
+static	void	py_free( PyObject *capsule )
+{
+	free( PyCapsule_GetPointer( capsule, NULL ) );
+}
+
+//  an array over buf that frees buf when it goes  //
+
+static	PyObject	*py_wrap( void *buf, int nd, npy_intp *dims, int type, int flags )
+{
+	PyObject	*arr = PyArray_New( &PyArray_Type, nd, dims, type, NULL, buf, 0, flags, NULL );
+	PyObject	*base;
+
+	if ( !arr ) {
+		free( buf );
+		return( NULL );
+	}
+
+	base = PyCapsule_New( buf, NULL, py_free );
+	if ( !base ) {
+		Py_DECREF( arr );
+		free( buf );
+		return( NULL );
+	}
+
+	//  the array takes base even when this fails, and base frees buf  //
+
+	if ( PyArray_SetBaseObject( (PyArrayObject*) arr, base ) ) {
+		Py_DECREF( arr );
+		return( NULL );
+	}
+
+	return( arr );
+}
+
+//  parse the poissonv3 arguments and generate: the number of points, -1 with an exception set  //
+
+static	int	py_generate( PyObject *args, PyObject *kw, int *ndim, int3 z, int **pts )
+{
+	static	char	*names[] = { "ndim", "seed", "shape", "tn", "tol", "z1", "z2", "z3", NULL };
+	PyObject	*shape_obj;
+	PyObject	*shape_str;
+	poisson_ctx	ctx;
+	const	char	*shape;
+	double	seed, tol;
+	long long	grid = 1;
+	float	sine_portion;
+	float	w;
+	int	tn, n, i;
+
+	z[1] = z[2] = 0;
+	if ( !PyArg_ParseTupleAndKeywords( args, kw, "idOidi|ii", names, ndim, &seed, &shape_obj, &tn, &tol, &z[0], &z[1], &z[2] ) ) return( -1 );
+
+	if ( *ndim < 1 || *ndim > 3 ) {
+		PyErr_SetString( PyExc_ValueError, "ndim must be 1, 2 or 3" );
+		return( -1 );
+	}
+	for ( i = 0 ; i < *ndim ; i++ ) {
+		if ( z[i] < 1 ) {
+			PyErr_Format( PyExc_ValueError, "size of dimension %d must be positive", i+1 );
+			return( -1 );
+		}
+		grid *= z[i];
+	}
+	if ( tn < 1 || tn > grid ) {
+		PyErr_Format( PyExc_ValueError, "tn must be between 1 and %lld", grid );
+		return( -1 );
+	}
+
+	//  the same conventions as poissonv3 for the unused dimensions  //
+
+	if ( *ndim == 1 ) { z[1] = 1; z[2] = 1; }
+	if ( *ndim == 2 ) z[2] = 0;
+	if ( tol == 0 ) tol = 0.000001;
+
+	shape_str = PyObject_Str( shape_obj );
+	if ( !shape_str ) return( -1 );
+	shape = PyUnicode_AsUTF8( shape_str );
+
+	poisson_ctx_init( &ctx );
+	if ( !shape || poisson_shape_parse( shape, &ctx.shape, ctx.shape_a ) ) {
+		if ( shape ) PyErr_Format( PyExc_ValueError, "unknown sine portion or density %s", shape );
+		Py_DECREF( shape_str );
+		return( -1 );
+	}
+	sine_portion = atof( shape );
+	Py_DECREF( shape_str );
+
+	ctx.threads = poisson_threads();
+	w = *ndim == 3 ? 1.0 : 2.0;
+
+	Py_BEGIN_ALLOW_THREADS
+	poisson_seed_clock( &ctx, seed );
+	n = poisson_points( &ctx, *ndim, z, tn, tol, sine_portion, &w, pts );
+	poisson_ctx_free( &ctx );
+	Py_END_ALLOW_THREADS
+
+	return( n );
+}
+
+static	PyObject	*py_points( PyObject *self, PyObject *args, PyObject *kw )
+{
+	int3	z;
+	int	*pts;
+	int	ndim, n;
+	npy_intp	dims[2];
+
+	if ( ( n = py_generate( args, kw, &ndim, z, &pts ) ) < 0 ) return( NULL );
+
+	dims[0] = n;
+	dims[1] = ndim;
+
+	return( py_wrap( pts, 2, dims, NPY_INT32, NPY_ARRAY_CARRAY ) );
+}
+
+static	PyObject	*py_mask( PyObject *self, PyObject *args, PyObject *kw )
+{
+	int3	z;
+	int	*pts;
+	int	ndim, n, i;
+	unsigned char	*m;
+	npy_intp	dims[3];
+
+	if ( ( n = py_generate( args, kw, &ndim, z, &pts ) ) < 0 ) return( NULL );
+
+	//  first dimension fastest, as the schedule: mask[x1, x2, x3] in Fortran order  //
+
+	m = ( unsigned char* ) calloc( (size_t) z[0]*( ndim > 1 ? z[1] : 1 )*( ndim > 2 ? z[2] : 1 ), 1 );
+	if ( !m ) {
+		free( pts );
+		return( PyErr_NoMemory() );
+	}
+	for ( i = 0 ; i < n ; i++ ) {
+		const	int	*p = pts + (size_t) i*ndim;
+		size_t	k = p[0];
+		if ( ndim > 1 ) k += (size_t) p[1]*z[0];
+		if ( ndim > 2 ) k += (size_t) p[2]*z[0]*z[1];
+		m[k] = 1;
+	}
+	free( pts );
+
+	for ( i = 0 ; i < ndim ; i++ ) dims[i] = z[i];
+
+	return( py_wrap( m, ndim, dims, NPY_UINT8, NPY_ARRAY_FARRAY ) );
+}
+
+static	PyMethodDef	py_methods[] = {
+	{ "points", (PyCFunction)(void(*)(void)) py_points, METH_VARARGS | METH_KEYWORDS,
+	  "points(ndim, seed, shape, tn, tol, z1, z2=0, z3=0): n x ndim int32 array of the sampled points" },
+	{ "mask", (PyCFunction)(void(*)(void)) py_mask, METH_VARARGS | METH_KEYWORDS,
+	  "mask(ndim, seed, shape, tn, tol, z1, z2=0, z3=0): uint8 array of the grid, 1 where sampled" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static	struct	PyModuleDef	py_module = {
+	PyModuleDef_HEAD_INIT, "poisson", "Poisson gap sampling schedules (poissonv3)", -1, py_methods
+};
+
+PyMODINIT_FUNC	PyInit_poisson( void )
+{
+	import_array();
+
+	return( PyModule_Create( &py_module ) );
+}
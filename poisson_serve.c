@@ -0,0 +1,189 @@
+// poissonv3 --serve: schedules on a local unix socket.
+//
+// One worker thread per processor accepts connections on the socket and
+// keeps its own generator context (random state and scratch planes) from
+// request to request. The warm start table and the schedule cache are
+// shared with the command line program, so a server and ordinary runs
+// learn from each other. See poisson_client.c for the protocol.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "poisson_SAR.h"
+#include "poisson_serve.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define	SERVE_TIMEOUT	5		//  seconds a client may stall before its worker drops it  //
+
+static	int	serve_all( int fd, const char *buf, size_t len )
+{
+	ssize_t	n;
+
+	while ( len > 0 ) {
+		n = write( fd, buf, len );
+		if ( n < 0 && errno == EINTR ) continue;
+		if ( n <= 0 ) return( -1 );
+		buf += n;
+		len -= n;
+	}
+
+	return( 0 );
+}
+
+static	void	serve_one( poisson_ctx *ctx, int fd )
+{
+	char	line[1024];
+	char	*argv[12];
+	char	env[16];
+	char	*tok, *save;
+	char	*out = NULL;
+	size_t	len = 0;
+	int	argc = 1;
+	int	n = 0;
+	int	r = 0;
+	int	status = -1;
+	FILE	*fp;
+
+	//  one request line; a client that closes or stalls before its end gets no reply  //
+
+	while ( n < (int) sizeof( line )-1 && ( r = read( fd, line+n, 1 ) ) == 1 && line[n] != '\n' ) n++;
+	if ( r != 1 ) return;
+	line[n] = 0;
+
+	argv[0] = "poissonv3";
+	for ( tok = strtok_r( line, " \t\r", &save ) ; tok && argc < 12 ; tok = strtok_r( NULL, " \t\r", &save ) ) {
+		argv[argc++] = tok;
+	}
+
+	//  a caller with other settings would get another schedule: refuse, it generates its own  //
+
+	snprintf( env, sizeof( env ), "env:%08lx", serve_env() );
+
+	fp = open_memstream( &out, &len );
+
+	if ( fp && argc == 11 && strcmp( argv[10], env ) == 0 ) status = poisson_request( ctx, argv, fp );
+
+	if ( fp ) fclose( fp );
+
+	snprintf( line, sizeof( line ), "%d\n", status ? -1 : 0 );
+	if ( serve_all( fd, line, strlen( line ) ) == 0 && status == 0 ) serve_all( fd, out, len );
+
+	free( out );
+}
+
+static	void	*serve_worker( void *arg )
+{
+	int	sfd = *(int*) arg;
+	int	fd;
+	poisson_ctx	ctx;
+	struct	timeval	tv = { SERVE_TIMEOUT, 0 };
+
+	poisson_ctx_init( &ctx );
+
+	for (;;) {
+		fd = accept( sfd, NULL, NULL );
+		if ( fd < 0 ) {
+			if ( errno == EINTR || errno == ECONNABORTED ) continue;
+			break;
+		}
+		setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+		setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+		serve_one( &ctx, fd );
+		close( fd );
+	}
+
+	poisson_ctx_free( &ctx );
+
+	return( NULL );
+}
+
+int	serve_run( const char *path )
+{
+	struct	sockaddr_un	addr;
+	char	sock[PATH_MAX];
+	pthread_t	*tid;
+	long	nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	int	sfd;
+	int	i;
+	mode_t	mask;
+
+	if ( serve_path( path, sock ) || strlen( sock ) >= sizeof( addr.sun_path ) ) {
+		fprintf( stderr, "No usable socket path for --serve\n" );
+		return( -1 );
+	}
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, sock );
+
+	sfd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( sfd < 0 ) {
+		perror( "socket" );
+		return( -1 );
+	}
+
+	unlink( sock );		//  left behind by a server that did not shut down cleanly  //
+
+	//  the socket is made for its owner only: there is no moment others could connect  //
+
+	mask = umask( 077 );
+	i = bind( sfd, (struct sockaddr*) &addr, sizeof( addr ) );
+	umask( mask );
+
+	if ( i || listen( sfd, 64 ) ) {
+		fprintf( stderr, "Cannot listen on %s: %s\n", sock, strerror( errno ) );
+		close( sfd );
+		return( -1 );
+	}
+
+	signal( SIGPIPE, SIG_IGN );	//  a client that went away must not end the server  //
+
+	if ( nthreads < 1 ) nthreads = 1;
+	tid = (pthread_t*) malloc( nthreads*sizeof( pthread_t ) );
+
+	fprintf( stderr, "poissonv3: serving on %s with %ld threads\n", sock, nthreads );
+
+	for ( i = 0 ; i < nthreads ; i++ ) {
+		if ( pthread_create( &tid[i], NULL, serve_worker, &sfd ) ) break;
+	}
+	if ( i == 0 ) {
+		fprintf( stderr, "Cannot start server threads\n" );
+		close( sfd );
+		unlink( sock );
+		return( -1 );
+	}
+
+	nthreads = i;
+	for ( i = 0 ; i < nthreads ; i++ ) pthread_join( tid[i], NULL );
+
+	close( sfd );
+	unlink( sock );
+	free( tid );
+
+	return( -1 );
+}
+
+#else
+
+int	serve_run( const char *path )
+{
+	fprintf( stderr, "--serve is not available on Windows\n" );
+	return( -1 );
+}
+
+#endif
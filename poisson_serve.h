@@ -0,0 +1,23 @@
+// Header file for poisson_serve.c and poisson_client.c //
+
+// input: path (socket path, NULL for the default), *updated* with the path used
+// return: 0, -1 if no path can be made
+
+int	serve_path( const char*, char* );
+
+// input: path of the socket to listen on (NULL for the default)
+// return: -1 if the socket can not be set up, otherwise does not return
+
+int	serve_run( const char* );
+
+// input: nothing
+// return: hash of the environment variables a schedule depends on (the server
+// refuses requests made under other settings)
+
+unsigned long	serve_env( void );
+
+// input: argv (program name and the 9 positional arguments), fp (stream the schedule is copied to)
+// return: 0 if the schedule came from a running poissonv3 --serve, -1 if there is none
+// (or it refused the request, or the request extends a file and must run locally), 1 if it failed after part of the schedule was copied
+
+int	serve_request( char**, FILE* );
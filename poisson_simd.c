@@ -0,0 +1,232 @@
+// Lane sampler for the plane streams of poissonv3 (POISSONV3_THREADS).
+//
+// A gap is a poisson number drawn by multiplying uniform numbers until the
+// product falls below exp(-lamda). Instead of one number per step, eight
+// xorshift128+ lanes give eight numbers at once; their running products
+// are formed by a three step prefix scan and the first lane whose product
+// falls below the limit ends the gap (the other lanes are dropped). The
+// AVX-512, AVX2 and plain C kernels do the same multiplications in the
+// same order, so a schedule does not depend on the processor it was made
+// on. The kernel is picked once, from the processor or from POISSONV3_SIMD
+// (avx512, avx2 or scalar).
+
+#include <stdlib.h>
+#include <string.h>
+#include "poisson_simd.h"
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+#define	LANES_X86
+#include <immintrin.h>
+#endif
+
+#define	LANES_ONE	0x3FF0000000000000ULL	//  exponent of 1.0: 52 random bits give [1,2)  //
+
+static	int	lanes_scalar( unsigned long long *st, double L )
+{
+	double	q[8], r[8];
+	double	p = 1;
+	int	k = 0;
+	int	i, j, s;
+
+	for (;;) {
+		for ( i = 0 ; i < 8 ; i++ ) {
+			unsigned long long	s1 = st[i];
+			unsigned long long	s0 = st[8+i];
+			unsigned long long	b;
+
+			st[i] = s0;
+			s1 ^= s1 << 23;
+			st[8+i] = s1 ^ s0 ^ ( s1 >> 17 ) ^ ( s0 >> 26 );
+			b = ( ( st[8+i] + s0 ) >> 12 ) | LANES_ONE;
+			memcpy( &q[i], &b, sizeof( double ) );
+			q[i] -= 1.0;
+		}
+
+		for ( s = 1 ; s < 8 ; s *= 2 ) {	//  q[i] becomes the product of lanes 0..i  //
+			for ( i = 0 ; i < 8 ; i++ ) r[i] = i >= s ? q[i]*q[i-s] : q[i];
+			memcpy( q, r, sizeof( q ) );
+		}
+
+		for ( j = 0 ; j < 8 ; j++ ) if ( p*q[j] < L ) return( k+j );
+
+		p *= q[7];
+		k += 8;
+	}
+}
+
+#ifdef LANES_X86
+
+__attribute__(( target( "avx2" ) ))
+static	__m256d	lanes_avx2_draw( __m256i *a, __m256i *b )
+{
+	__m256i	s1 = *a;
+	__m256i	s0 = *b;
+	__m256i	x;
+
+	*a = s0;
+	s1 = _mm256_xor_si256( s1, _mm256_slli_epi64( s1, 23 ) );
+	*b = _mm256_xor_si256( _mm256_xor_si256( s1, s0 ), _mm256_xor_si256( _mm256_srli_epi64( s1, 17 ), _mm256_srli_epi64( s0, 26 ) ) );
+	x = _mm256_or_si256( _mm256_srli_epi64( _mm256_add_epi64( *b, s0 ), 12 ), _mm256_set1_epi64x( LANES_ONE ) );
+
+	return( _mm256_sub_pd( _mm256_castsi256_pd( x ), _mm256_set1_pd( 1.0 ) ) );
+}
+
+__attribute__(( target( "avx2" ) ))
+static	int	lanes_avx2( unsigned long long *st, double L )
+{
+	__m256i	a0 = _mm256_loadu_si256( (__m256i*) st );
+	__m256i	a1 = _mm256_loadu_si256( (__m256i*) ( st+4 ) );
+	__m256i	b0 = _mm256_loadu_si256( (__m256i*) ( st+8 ) );
+	__m256i	b1 = _mm256_loadu_si256( (__m256i*) ( st+12 ) );
+	__m256d	lim = _mm256_set1_pd( L );
+	double	p = 1;
+	int	k = 0;
+	int	m;
+
+	for (;;) {
+		__m256d	lo = lanes_avx2_draw( &a0, &b0 );
+		__m256d	hi = lanes_avx2_draw( &a1, &b1 );
+		__m256d	t, u;
+		__m256d	pp = _mm256_set1_pd( p );
+
+		//  shift by 1  //
+		t = _mm256_permute4x64_pd( hi, _MM_SHUFFLE( 2, 1, 0, 0 ) );
+		t = _mm256_blend_pd( t, _mm256_permute4x64_pd( lo, _MM_SHUFFLE( 3, 3, 3, 3 ) ), 0x1 );
+		u = _mm256_permute4x64_pd( lo, _MM_SHUFFLE( 2, 1, 0, 0 ) );
+		hi = _mm256_mul_pd( hi, t );
+		lo = _mm256_blend_pd( lo, _mm256_mul_pd( lo, u ), 0xE );
+
+		//  shift by 2  //
+		t = _mm256_permute4x64_pd( hi, _MM_SHUFFLE( 1, 0, 0, 0 ) );
+		t = _mm256_blend_pd( t, _mm256_permute4x64_pd( lo, _MM_SHUFFLE( 3, 2, 3, 2 ) ), 0x3 );
+		u = _mm256_permute4x64_pd( lo, _MM_SHUFFLE( 1, 0, 0, 0 ) );
+		hi = _mm256_mul_pd( hi, t );
+		lo = _mm256_blend_pd( lo, _mm256_mul_pd( lo, u ), 0xC );
+
+		//  shift by 4  //
+		hi = _mm256_mul_pd( hi, lo );
+
+		m = _mm256_movemask_pd( _mm256_cmp_pd( _mm256_mul_pd( pp, lo ), lim, _CMP_LT_OQ ) );
+		m |= _mm256_movemask_pd( _mm256_cmp_pd( _mm256_mul_pd( pp, hi ), lim, _CMP_LT_OQ ) ) << 4;
+
+		if ( m ) {
+			k += __builtin_ctz( m );
+			break;
+		}
+
+		p *= _mm256_cvtsd_f64( _mm256_permute4x64_pd( hi, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+		k += 8;
+	}
+
+	_mm256_storeu_si256( (__m256i*) st, a0 );
+	_mm256_storeu_si256( (__m256i*) ( st+4 ), a1 );
+	_mm256_storeu_si256( (__m256i*) ( st+8 ), b0 );
+	_mm256_storeu_si256( (__m256i*) ( st+12 ), b1 );
+
+	return( k );
+}
+
+__attribute__(( target( "avx512f" ) ))
+static	int	lanes_avx512( unsigned long long *st, double L )
+{
+	__m512i	a = _mm512_loadu_si512( st );
+	__m512i	b = _mm512_loadu_si512( st+8 );
+	__m512i	one = _mm512_set1_epi64( LANES_ONE );
+	__m512i	i1 = _mm512_set_epi64( 6, 5, 4, 3, 2, 1, 0, 0 );
+	__m512i	i2 = _mm512_set_epi64( 5, 4, 3, 2, 1, 0, 0, 0 );
+	__m512i	i4 = _mm512_set_epi64( 3, 2, 1, 0, 0, 0, 0, 0 );
+	__m512d	lim = _mm512_set1_pd( L );
+	double	p = 1;
+	int	k = 0;
+	int	m;
+
+	for (;;) {
+		__m512i	s1 = a;
+		__m512i	s0 = b;
+		__m512d	q;
+
+		a = s0;
+		s1 = _mm512_xor_si512( s1, _mm512_slli_epi64( s1, 23 ) );
+		b = _mm512_xor_si512( _mm512_xor_si512( s1, s0 ), _mm512_xor_si512( _mm512_srli_epi64( s1, 17 ), _mm512_srli_epi64( s0, 26 ) ) );
+		q = _mm512_castsi512_pd( _mm512_or_si512( _mm512_srli_epi64( _mm512_add_epi64( b, s0 ), 12 ), one ) );
+		q = _mm512_sub_pd( q, _mm512_set1_pd( 1.0 ) );
+
+		q = _mm512_mask_mul_pd( q, 0xFE, q, _mm512_permutexvar_pd( i1, q ) );
+		q = _mm512_mask_mul_pd( q, 0xFC, q, _mm512_permutexvar_pd( i2, q ) );
+		q = _mm512_mask_mul_pd( q, 0xF0, q, _mm512_permutexvar_pd( i4, q ) );
+
+		m = _mm512_cmp_pd_mask( _mm512_mul_pd( _mm512_set1_pd( p ), q ), lim, _CMP_LT_OQ );
+
+		if ( m ) {
+			k += __builtin_ctz( m );
+			break;
+		}
+
+		p *= _mm512_cvtsd_f64( _mm512_permutexvar_pd( _mm512_set1_epi64( 7 ), q ) );
+		k += 8;
+	}
+
+	_mm512_storeu_si512( st, a );
+	_mm512_storeu_si512( st+8, b );
+
+	return( k );
+}
+
+#endif
+
+static	int	( *lanes_fn )( unsigned long long*, double ) = NULL;
+static	const	char	*lanes_name = "scalar";
+
+static	void	lanes_pick( void )
+{
+	int	( *fn )( unsigned long long*, double ) = lanes_scalar;
+	char	*env = getenv( "POISSONV3_SIMD" );
+
+	lanes_name = "scalar";
+
+#ifdef LANES_X86
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx512f" ) && ( !env || strcmp( env, "avx512" ) == 0 ) ) {
+		fn = lanes_avx512;
+		lanes_name = "avx512";
+	}
+	else if ( __builtin_cpu_supports( "avx2" ) && ( !env || strcmp( env, "avx512" ) == 0 || strcmp( env, "avx2" ) == 0 ) ) {
+		fn = lanes_avx2;
+		lanes_name = "avx2";
+	}
+#endif
+
+	__atomic_store_n( &lanes_fn, fn, __ATOMIC_RELEASE );
+}
+
+int	lanes_poisson( unsigned long long *st, double L )
+{
+	int	( *fn )( unsigned long long*, double ) = __atomic_load_n( &lanes_fn, __ATOMIC_ACQUIRE );
+
+	if ( !fn ) {
+		lanes_pick();		//  every kernel gives the same numbers: racing first calls are harmless  //
+		fn = lanes_fn;
+	}
+
+	return( fn( st, L ) );
+}
+
+void	lanes_seed( unsigned long long seed, unsigned long long *st )
+{
+	int	i;
+
+	for ( i = 0 ; i < 16 ; i++ ) {
+		unsigned long long	x = ( seed += 0x9E3779B97F4A7C15ULL );	//  splitmix64  //
+
+		x = ( x ^ ( x >> 30 ) )*0xBF58476D1CE4E5B9ULL;
+		x = ( x ^ ( x >> 27 ) )*0x94D049BB133111EBULL;
+		st[i] = x ^ ( x >> 31 );
+	}
+}
+
+const	char	*lanes_kernel( void )
+{
+	if ( !__atomic_load_n( &lanes_fn, __ATOMIC_ACQUIRE ) ) lanes_pick();
+
+	return( lanes_name );
+}
@@ -0,0 +1,16 @@
+// Header file for poisson_simd.c //
+
+// input: st (xorshift128+ state of 8 lanes, 16 words, *updated*), L (exp(-lamda))
+// return: a poisson random number, the same whichever kernel is in use
+
+int	lanes_poisson( unsigned long long*, double );
+
+// input: seed, st (16 words, *updated*)
+// return: nothing
+
+void	lanes_seed( unsigned long long, unsigned long long* );
+
+// input: nothing
+// return: name of the kernel in use (avx512, avx2 or scalar)
+
+const	char	*lanes_kernel( void );